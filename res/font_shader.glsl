@@ -4,11 +4,11 @@ uniform sampler2DArray sprites;
 
 layout (location=0) in vec2 pos;
 layout (location=1) in vec2 uv;
-layout (location=2) in float sprite;
+layout (location=2) in uint sprite;
 layout (location=3) in vec4 color;
 layout (location=4) in float sdf_low;
 layout (location=5) in float sdf_high;
-layout (location=6) in int sdf_border;
+layout (location=6) in uint sdf_border;
 
 out vec3 pass_uv;
 out vec4 pass_color;
@@ -18,12 +18,12 @@ flat out int pass_border;
 
 void main() {
     gl_Position = vec4(pos.x, pos.y / win.aspect_ratio, 0.0, 1.0);
-    pass_uv = vec3(uv, sprite);
+    pass_uv = vec3(uv, float(sprite));
     pass_color = color;
 
     pass_low = sdf_low;
     pass_high = sdf_high;
-    pass_border = sdf_border;
+    pass_border = int(sdf_border);
 }
 
 #else
@@ -4,18 +4,25 @@ uniform sampler2DArray sprites;
 
 layout (location=0) in vec2 pos;
 layout (location=1) in vec2 uv;
-layout (location=2) in float sprite;
+layout (location=2) in uint sprite;
 layout (location=3) in vec4 color;
 
 out vec3 pass_uv;
 out vec4 pass_color;
 
 void main() {
-    Camera camera = cam[current_cam];
+    // Every instance is one of the cameras, and only draws on
+    // its part of the screen.
+    Camera camera = cam[view_cams[gl_InstanceID]];
     vec2 cam_scale = vec2(camera.zoom, camera.zoom / camera.aspect_ratio);
     vec2 world_pos = (pos + camera.pos + camera.offset) * cam_scale;
     gl_Position = vec4(world_pos, 0.0, 1.0);
-    pass_uv = vec3(uv, sprite);
+    float view_width = 2.0 / float(num_views);
+    float view_left = -1.0 + view_width * float(gl_InstanceID);
+    gl_ClipDistance[0] = world_pos.x - view_left;
+    gl_ClipDistance[1] = view_left + view_width - world_pos.x;
+    // Untextured verticies are told apart by a negative sprite.
+    pass_uv = vec3(uv, sprite == INVALID_SPRITE ? -1.0 : float(sprite));
     pass_color = color;
 }
 
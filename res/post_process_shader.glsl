@@ -19,15 +19,7 @@ in vec4 pass_color;
 out vec4 color;
 
 void main() {
-    if (num_active_samplers == 1) {
-        color = texture(screen_samplers[0], pass_uv);
-    } else {
-        if (pass_uv.x > 0.5) {
-            color = texture(screen_samplers[1], pass_uv);
-        } else {
-            color = texture(screen_samplers[0], pass_uv);
-        }
-    }
+    color = texture(screen_sampler, pass_uv);
 }
 
 #endif
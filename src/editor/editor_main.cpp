@@ -2,6 +2,7 @@
 
 #include "editor_main.h"
 #include "entity_io.cpp"
+#include "level_stream.cpp"
 
 namespace Editor {
 
@@ -20,6 +21,9 @@ void draw_outline(Logic::Entity *e, Vec4 color) {
 }
 
 const char *FILE_NAME = "test.ent";
+const char *COMPILED_FILE_NAME = "test.lvl";
+const char *STREAMED_FILE_NAME = "test.lvls";
+const f32 STREAMED_CHUNK_SIZE = 16.0;
 
 void setup() {
     using namespace Input;
@@ -124,6 +128,7 @@ void set_entity_field(Logic::Entity *e, const char *name, u64 size, void *value)
         if (meta->size != size) break;
         u8 *addrs = ((u8 *) e) + field->offset;
         Util::copy_bytes(value, addrs, size);
+        Logic::mark_dirty(e, Logic::field_bit(i));
         return;
     }
     ERR("Failed to find field %s", name);
@@ -133,11 +138,7 @@ void set_entity_field(Logic::Entity *e, const char *name, u64 size, void *value)
 void update() {
     static bool first = true;
     if (first) {
-        FILE *f = fopen(FILE_NAME, "r");
-        if (f) {
-            load_entities(f);
-            fclose(f);
-        }
+        load_level(FILE_NAME, COMPILED_FILE_NAME);
         first = false;
     }
 
@@ -210,6 +211,8 @@ void update() {
         }
         if (pressed(Name::EDIT_DO)) {
             write_entities_to_file(FILE_NAME);
+            write_compiled_entities_to_file(COMPILED_FILE_NAME);
+            write_streamed_level(STREAMED_FILE_NAME, STREAMED_CHUNK_SIZE);
             current_mode = EditorMode::SELECT_MODE;
         }
     }
@@ -102,11 +102,13 @@ struct EditorEdit {
     void apply(Logic::Entity *e) {
         u8 *type_ignorer = (u8 *) e;
         Util::copy_bytes((void *) &after, type_ignorer + offset, size);
+        Logic::mark_field_dirty(e, offset);
     }
 
     void revert(Logic::Entity *e) {
         u8 *type_ignorer = (u8 *) e;
         Util::copy_bytes((void *) &before, type_ignorer + offset, size);
+        Logic::mark_field_dirty(e, offset);
     }
 };
 
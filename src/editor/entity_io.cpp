@@ -1,3 +1,5 @@
+#include <sys/stat.h>
+
 namespace Editor {
 
 template <typename T>
@@ -124,16 +126,254 @@ void write_entity(FILE *stream, Logic::Entity *e) {
     }
 }
 
+// What each entity looked like when it was last saved, indexed
+// by slot, so only the entities that changed are serialized again.
+// The dirty bits say what changed, but they miss plain writes to types
+// that don't track changes, so those are compared with a copy of the
+// fields made when the entity was saved.
+struct SavedEntity {
+    Logic::EntityID id;
+    // The registered fields, one after the other. Only kept for
+    // types that don't track changes.
+    u8 *fields;
+    u64 fields_size;
+    char *data;
+    size_t size;
+};
+
+Util::List<SavedEntity> _fog_saved_entities;
+
+// Calls "f" with the bytes of every registered field of "e".
+template <typename F>
+static void for_field_bytes(Logic::Entity *e, F f) {
+    Logic::EMeta meta = Logic::meta_data_for(e->type());
+    for (u32 i = 0; i < meta.num_fields; i++) {
+        auto *field = meta.fields + i;
+        f(((u8 *) e) + field->offset, Logic::fetch_type(field->hash)->size);
+    }
+}
+
+static bool fields_unchanged(SavedEntity *saved, Logic::Entity *e) {
+    if (!(saved->id == e->id)) return false;
+    u64 offset = 0;
+    bool same = true;
+    for_field_bytes(e, [&](u8 *bytes, u64 size) {
+        same &= offset + size <= saved->fields_size
+                && !memcmp(saved->fields + offset, bytes, size);
+        offset += size;
+    });
+    return same && offset == saved->fields_size;
+}
+
+static bool unchanged_since_save(SavedEntity *saved, Logic::Entity *e) {
+    if (!(saved->id == e->id) || Logic::dirty_fields(e)) return false;
+    if (Logic::meta_data_for(e->type()).track_changes) return true;
+    return fields_unchanged(saved, e);
+}
+
+SavedEntity *serialized_entity(Logic::Entity *e) {
+    if (!_fog_saved_entities.initalized) {
+        Util::allow_allocation();
+        _fog_saved_entities = Util::create_list<SavedEntity>(128);
+    }
+    while (_fog_saved_entities.length <= (u32) e->id.slot) {
+        Util::allow_allocation();
+        _fog_saved_entities.append({Logic::invalid_id(), nullptr, 0, nullptr, 0});
+    }
+
+    SavedEntity *saved = _fog_saved_entities + e->id.slot;
+    if (unchanged_since_save(saved, e))
+        return saved;
+
+    free(saved->data);
+    FILE *stream = open_memstream(&saved->data, &saved->size);
+    ASSERT(stream, "Failed to serialize entity");
+    write_entity(stream, e);
+    fclose(stream);
+
+    saved->id = e->id;
+    saved->fields_size = 0;
+    if (Logic::meta_data_for(e->type()).track_changes)
+        return saved;
+    for_field_bytes(e, [saved](u8 *, u64 size) { saved->fields_size += size; });
+    Util::allow_allocation();
+    saved->fields = Util::resize_memory<u8>(saved->fields, saved->fields_size);
+    u64 offset = 0;
+    for_field_bytes(e, [saved, &offset](u8 *bytes, u64 size) {
+        Util::copy_bytes(bytes, saved->fields + offset, size);
+        offset += size;
+    });
+    return saved;
+}
+
 void write_entities_to_file(const char *filename) {
+    // Picks up the plain writes to the types that track changes.
+    Logic::track_entity_changes();
     FILE *f = fopen(filename, "w");
     u32 num = Logic::_fog_es.num_entities;
     write_to_file(f, &num);
     auto write_to_file = [f](Logic::Entity *e) {
-        write_entity(f, e);
+        SavedEntity *saved = serialized_entity(e);
+        ASSERT(fwrite(saved->data, 1, saved->size, f) == saved->size,
+               "Failed to write entity");
         return false;
     };
     Logic::for_entity(write_to_file);
     fclose(f);
+    // Everything is saved, so the next save only looks at new changes.
+    Logic::clear_dirty();
+}
+
+//
+// The compiled level format, the source format above is kept for editing
+// and interchange. The compiled one is one block per entity type with the
+// raw entity memory, so it can be read straight into the pools. It's only
+// valid as long as the entity structs look the same, if they don't the
+// source format is used instead.
+//
+constexpr u32 COMPILED_LEVEL_MAGIC = 0x4C56464F; // "OFVL"
+constexpr u32 COMPILED_LEVEL_VERSION = 1;
+
+struct CompiledLevelHeader {
+    u32 magic;
+    u32 version;
+    u32 num_types;
+};
+
+// Writes the records of the entities, which all have to be of the
+// type. Only the registered fields are saved, the same as the source
+// format, everything else is left zeroed.
+void write_entity_records(FILE *f, Logic::EntityType type,
+                          Logic::Entity **entities, u32 count) {
+    using namespace Logic;
+    EMeta meta = meta_data_for(type);
+    u64 *sizes = Util::request_temporary_memory<u64>(meta.num_fields);
+    for (u32 i = 0; i < meta.num_fields; i++)
+        sizes[i] = fetch_type(meta.fields[i].hash)->size;
+
+    Util::allow_allocation();
+    u8 *memory = Util::push_memory<u8>(count * meta.size);
+    memset(memory, 0, count * meta.size);
+    for (u32 i = 0; i < count; i++) {
+        u8 *entity = (u8 *) entities[i];
+        u8 *record = memory + i * meta.size;
+        for (u32 j = 0; j < meta.num_fields; j++) {
+            u64 offset = meta.fields[j].offset;
+            Util::copy_bytes(entity + offset, record + offset, sizes[j]);
+        }
+    }
+    write_to_file(f, memory, count * meta.size);
+    Util::pop_memory(memory);
+}
+
+void write_compiled_entities_to_file(const char *filename) {
+    using namespace Logic;
+    FILE *f = fopen(filename, "wb");
+    ASSERT(f, "Failed to open compiled level");
+
+    CompiledTypeBlock blocks[_NUM_ENTITY_TYPES];
+    CompiledLevelHeader header = {COMPILED_LEVEL_MAGIC, COMPILED_LEVEL_VERSION, 0};
+    for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+        EntityPool *pool = _fog_es.pools + type;
+        if (!pool->num_alive) continue;
+        blocks[header.num_types++] = {(EntityType) type, pool->num_alive, pool->stride,
+                                      layout_signature((EntityType) type)};
+    }
+    write_to_file(f, &header);
+    write_to_file(f, blocks, header.num_types);
+
+    for (u32 b = 0; b < header.num_types; b++) {
+        CompiledTypeBlock *block = blocks + b;
+        EntityPool *pool = _fog_es.pools + (u32) block->type;
+        Util::allow_allocation();
+        Entity **entities = Util::push_memory<Entity *>(block->count);
+        u32 count = 0;
+        for (u32 i = 0; i < pool->length; i++) {
+            Entity *entity = pool->get(i);
+            if (is_linked(entity))
+                entities[count++] = entity;
+        }
+        write_entity_records(f, block->type, entities, count);
+        Util::pop_memory(entities);
+    }
+    fclose(f);
+}
+
+// The number of bytes from where the stream is to the end of the file.
+static u64 bytes_left(FILE *stream) {
+    struct stat info;
+    long at = ftell(stream);
+    if (at < 0 || fstat(fileno(stream), &info) != 0 || info.st_size < at)
+        return 0;
+    return info.st_size - at;
+}
+
+// Returns false if the file isn't a compiled level that matches the
+// entities, nothing is loaded if that's the case.
+bool load_compiled_entities(FILE *stream) {
+    using namespace Logic;
+    CompiledLevelHeader header;
+    if (fread(&header, sizeof(header), 1, stream) != 1) return false;
+    if (header.magic != COMPILED_LEVEL_MAGIC) return false;
+    if (header.version != COMPILED_LEVEL_VERSION) return false;
+    if (header.num_types > _NUM_ENTITY_TYPES) return false;
+
+    CompiledTypeBlock blocks[_NUM_ENTITY_TYPES];
+    if (fread(blocks, sizeof(blocks[0]), header.num_types, stream) != header.num_types)
+        return false;
+    bool seen[_NUM_ENTITY_TYPES] = {};
+    for (u32 b = 0; b < header.num_types; b++) {
+        if (!matches_layout(blocks + b)) return false;
+        // Two blocks of the same type would be read to the same place.
+        if (seen[(u32) blocks[b].type]) return false;
+        seen[(u32) blocks[b].type] = true;
+    }
+
+    // The counts come from the file, so they're checked against
+    // what's left of it before any room is reserved.
+    u64 left = bytes_left(stream);
+    for (u32 b = 0; b < header.num_types; b++) {
+        CompiledTypeBlock *block = blocks + b;
+        if (block->count > left / block->stride) {
+            ERR("The compiled level has more entities than it has room for");
+            return false;
+        }
+        left -= block->count * block->stride;
+    }
+
+    // All the blocks are read before any entity is added, the reserved
+    // room isn't used until then, so a short file leaves nothing behind.
+    for (u32 b = 0; b < header.num_types; b++) {
+        CompiledTypeBlock *block = blocks + b;
+        u8 *memory = reserve_entities(block->type, block->count);
+        u64 size = block->count * block->stride;
+        if (fread(memory, 1, size, stream) != size) {
+            ERR("The compiled level is cut short");
+            return false;
+        }
+    }
+    for (u32 b = 0; b < header.num_types; b++)
+        add_entities_bulk(blocks[b].type, blocks[b].count);
+    return true;
+}
+
+// Loads the compiled level if it's up to date, otherwise the source.
+void load_level(const char *source, const char *compiled) {
+    struct stat source_stat, compiled_stat;
+    bool has_source = stat(source, &source_stat) == 0;
+    bool has_compiled = stat(compiled, &compiled_stat) == 0;
+    if (has_compiled &&
+        (!has_source || source_stat.st_mtime <= compiled_stat.st_mtime)) {
+        FILE *f = fopen(compiled, "rb");
+        bool loaded = f && load_compiled_entities(f);
+        if (f) fclose(f);
+        if (loaded) return;
+    }
+    if (!has_source) return;
+    FILE *f = fopen(source, "r");
+    if (!f) return;
+    load_entities(f);
+    fclose(f);
 }
 
 }
@@ -0,0 +1,110 @@
+#include <algorithm>
+
+namespace Editor {
+
+///*
+// Splits the entities in the ES up into square chunks and writes
+// them as a streamed level, which is loaded with
+// "Logic::open_level_stream".
+void write_streamed_level(const char *filename, f32 chunk_size);
+
+struct ChunkEntry {
+    s32 x, y;
+    Logic::EntityType type;
+    Logic::Entity *entity;
+
+    bool operator< (const ChunkEntry &other) const {
+        if (x != other.x) return x < other.x;
+        if (y != other.y) return y < other.y;
+        return type < other.type;
+    }
+};
+
+// Writes all the entries of one type in one chunk as a block.
+static void write_chunk_block(FILE *f, ChunkEntry *entries, u32 count) {
+    Logic::EntityType type = entries[0].type;
+    Logic::EMeta meta = Logic::meta_data_for(type);
+    Logic::CompiledTypeBlock block = {type, count, meta.size, Logic::layout_signature(type)};
+    write_to_file(f, &block);
+
+    Logic::Entity **entities = Util::request_temporary_memory<Logic::Entity *>(count);
+    for (u32 i = 0; i < count; i++)
+        entities[i] = entries[i].entity;
+    write_entity_records(f, type, entities, count);
+}
+
+void write_streamed_level(const char *filename, f32 chunk_size) {
+    using namespace Logic;
+    ASSERT(chunk_size > 0, "Invalid chunk size");
+    Util::allow_allocation();
+    ChunkEntry *entries = Util::push_memory<ChunkEntry>(_fog_es.num_entities);
+    u32 num_entries = 0;
+    for_entity([&](Entity *e) {
+        entries[num_entries++] = {(s32) floor(e->position.x / chunk_size),
+                                  (s32) floor(e->position.y / chunk_size),
+                                  e->type(), e};
+        return false;
+    });
+    std::sort(entries, entries + num_entries);
+
+    u32 num_chunks = 0;
+    for (u32 i = 0; i < num_entries; i++) {
+        if (i == 0 || entries[i].x != entries[i - 1].x ||
+            entries[i].y != entries[i - 1].y)
+            num_chunks++;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    ASSERT(f, "Failed to open streamed level");
+    StreamedLevelHeader header = {STREAMED_LEVEL_MAGIC, STREAMED_LEVEL_VERSION,
+                                  num_chunks, chunk_size};
+    write_to_file(f, &header);
+    // The table is written again when the offsets are known.
+    Util::allow_allocation();
+    ChunkHeader *chunks = Util::push_memory<ChunkHeader>(num_chunks);
+    u64 table_offset = ftell(f);
+    write_to_file(f, chunks, num_chunks);
+
+    u32 first = 0;
+    for (u32 c = 0; c < num_chunks; c++) {
+        u32 last = first + 1;
+        while (last < num_entries && entries[last].x == entries[first].x &&
+               entries[last].y == entries[first].y)
+            last++;
+
+        ChunkHeader *chunk = chunks + c;
+        *chunk = {};
+        chunk->offset = ftell(f);
+        chunk->num_entities = last - first;
+        chunk->min = entries[first].entity->position;
+        chunk->max = entries[first].entity->position;
+        for (u32 i = first; i < last; i++) {
+            Entity *e = entries[i].entity;
+            // A box that contains the entity no matter how it's rotated.
+            f32 radius = (ABS(e->scale.x) + ABS(e->scale.y)) / 2.0;
+            chunk->min = V2(MIN(chunk->min.x, e->position.x - radius),
+                            MIN(chunk->min.y, e->position.y - radius));
+            chunk->max = V2(MAX(chunk->max.x, e->position.x + radius),
+                            MAX(chunk->max.y, e->position.y + radius));
+        }
+
+        u32 block_start = first;
+        for (u32 i = first + 1; i <= last; i++) {
+            if (i != last && entries[i].type == entries[block_start].type)
+                continue;
+            write_chunk_block(f, entries + block_start, i - block_start);
+            chunk->num_blocks++;
+            block_start = i;
+        }
+        chunk->size = ftell(f) - chunk->offset;
+        first = last;
+    }
+
+    fseek(f, table_offset, SEEK_SET);
+    write_to_file(f, chunks, num_chunks);
+    fclose(f);
+    Util::pop_memory(chunks);
+    Util::pop_memory(entries);
+}
+
+}
@@ -1,27 +1,304 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// The file format:
+//
+// Number of Assets,
+// Size of String list,
+// Size of header,
+// size of body
+// =============================
+// String list
+// =============================
+// Headers
+// =============================
+// Assets
 namespace Asset {
 
+constexpr s32 NO_SLICE = -1;
+
+// Where an asset is, if it isn't resident it's only in the file.
+struct Residency {
+    bool resident;
+    s32 slice;
+    u64 last_used;
+    // The request on the loader, 0 if there is none.
+    u64 ticket;
+    // Number of sounds that are playing this asset.
+    std::atomic<u32> users;
+};
+
 struct System {
     FileHeader file_header;
     char *strings;
     Header *headers;
     Data *assets;
+    Residency *residency;
+
+    // The whole asset file, pages are read in when they're touched.
+    u8 *file;
+    u64 file_size;
+
+    // Which texture owns each slice on the GPU.
+    s64 slice_owner[OPENGL_TEXTURE_DEPTH];
+    u32 texture_budget;
+    u64 sound_budget;
+    u64 sound_memory;
+    u64 frame;
 
     Util::MemoryArena *arena;
 } system = {};
 
+// A copy of an asset that the loader has read, waiting
+// to be put in place by the main thread.
+struct Staged {
+    AssetID id;
+    u8 *data;
+};
+
+// The loader thread reads assets into staging memory, everything
+// that touches the GPU or the residency is left to "pump_uploads".
+// Requests are handled in order, so a ticket is done when all
+// requests up to it are.
+struct Loader {
+    static constexpr u32 QUEUE_SIZE = 256;
+
+    AssetID requests[QUEUE_SIZE];
+    u32 request_head;
+    u32 request_tail;
+
+    Staged staged[QUEUE_SIZE];
+    u32 staged_head;
+    u32 staged_tail;
+
+    // Only touched by the main thread.
+    u64 issued;
+    u64 completed;
+
+    bool running;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread thread;
+} loader;
+
+static_assert(SoundStream::SEGMENT_SIZE == Util::BlockHeader::BLOCK_SIZE,
+              "A segment has to be one compressed block");
+
+// Fills the windows of the streams that are playing.
+struct Streamer {
+    SoundStream streams[MAX_STREAMS];
+
+    bool running;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread thread;
+} streamer;
+
+// Tells the OS it can drop the pages, they're read in again
+// from the file if they're touched.
+static void release_pages(const u8 *data, u64 size) {
+    const u64 PAGE = sysconf(_SC_PAGESIZE);
+    u64 begin = ((u64) data + PAGE - 1) & ~(PAGE - 1);
+    u64 end = ((u64) data + size) & ~(PAGE - 1);
+    if (begin < end)
+        madvise((void *) begin, end - begin, MADV_DONTNEED);
+}
+
+static const u8 *asset_data(AssetID id) {
+    return system.file + system.headers[id].offset;
+}
+
+// The least recently used slice, that hasn't been used this frame.
+static s32 oldest_slice() {
+    s32 oldest = NO_SLICE;
+    for (u32 slice = 0; slice < OPENGL_TEXTURE_DEPTH; slice++) {
+        s64 owner = system.slice_owner[slice];
+        if (owner == ASSET_ID_NO_ASSET) continue;
+        if (system.residency[owner].last_used == system.frame) continue;
+        if (oldest == NO_SLICE ||
+            system.residency[owner].last_used <
+            system.residency[system.slice_owner[oldest]].last_used)
+            oldest = slice;
+    }
+    return oldest;
+}
+
+// The budget is the number of slices that can be used. A texture that
+// has been fetched this frame is never evicted, since what's already
+// pushed points at its slice, so if all of them have been the budget
+// is exceeded until the next texture is paged in.
+static s32 claim_slice() {
+    u32 used = 0;
+    s32 free_slice = NO_SLICE;
+    for (u32 slice = 0; slice < OPENGL_TEXTURE_DEPTH; slice++) {
+        if (system.slice_owner[slice] != ASSET_ID_NO_ASSET)
+            used++;
+        else if (free_slice == NO_SLICE)
+            free_slice = slice;
+    }
+    while (used >= system.texture_budget) {
+        s32 oldest = oldest_slice();
+        if (oldest == NO_SLICE) {
+            ERR("All textures in memory are used this frame, going over the budget");
+            break;
+        }
+        Residency *evicted = system.residency + system.slice_owner[oldest];
+        evicted->resident = false;
+        evicted->slice = NO_SLICE;
+        system.slice_owner[oldest] = ASSET_ID_NO_ASSET;
+        free_slice = free_slice == NO_SLICE ? oldest : MIN(free_slice, oldest);
+        used--;
+    }
+    ASSERT(free_slice != NO_SLICE, "All texture slices are used this frame");
+    return free_slice;
+}
+
+static void page_in_texture(AssetID id, const u8 *asset) {
+    // The file isn't aligned, and an Image can't be default constructed.
+    alignas(Image) u8 buffer[sizeof(Image)];
+    Util::copy_bytes((void *) asset, buffer, sizeof(Image));
+    Image *stored = (Image *) buffer;
+    s32 slice = claim_slice();
+    Image image = {(u8 *) asset + sizeof(Data), stored->width,
+                   stored->height, stored->components, (u16) slice};
+    Renderer::upload_texture(image, slice);
+    // The pixels are only kept on the GPU.
+    image.data = nullptr;
+    Util::copy_bytes(&image, &system.assets[id].image, sizeof(Image));
+    system.slice_owner[slice] = id;
+    system.residency[id].slice = slice;
+}
+
+static void evict_sounds(u64 size) {
+    while (system.sound_memory + size > system.sound_budget) {
+        s64 oldest = -1;
+        for (u64 id = 0; id < system.file_header.number_of_assets; id++) {
+            Residency *residency = system.residency + id;
+            if (system.headers[id].type != Type::SOUND || !residency->resident) continue;
+            if (residency->users.load(std::memory_order_acquire)) continue;
+            if (oldest == -1 || residency->last_used < system.residency[oldest].last_used)
+                oldest = id;
+        }
+        if (oldest == -1) {
+            ERR("All sounds in memory are playing, going over the budget");
+            return;
+        }
+        Sound *sound = &system.assets[oldest].sound;
+        system.sound_memory -= sound->size;
+        Util::pop_memory(sound->data);
+        sound->data = nullptr;
+        system.residency[oldest].resident = false;
+    }
+}
+
+static void page_in_sound(AssetID id, const u8 *asset) {
+    Sound sound;
+    Util::copy_bytes((void *) asset, &sound, sizeof(Sound));
+    evict_sounds(sound.size);
+    // Copied, so the audio thread never waits for the disk.
+    Util::allow_allocation();
+    sound.data = Util::push_memory<u8>(sound.size);
+    Util::copy_bytes((void *) (asset + sizeof(Data)), sound.data, sound.size);
+    system.assets[id].sound = sound;
+    system.sound_memory += sound.size;
+}
+
+static void page_in_font(AssetID id, const u8 *asset) {
+    Util::copy_bytes((void *) asset, system.assets + id, sizeof(Data));
+    const u8 *read_head = asset + sizeof(Data);
+    Font *font = &system.assets[id].font;
+    font->glyphs = system.arena->push<Font::Glyph>(font->num_glyphs);
+    Util::copy_bytes((void *) read_head, font->glyphs,
+                     sizeof(Font::Glyph) * font->num_glyphs);
+    read_head += sizeof(Font::Glyph) * font->num_glyphs;
+    font->kernings = nullptr;
+    font->kerning_table = nullptr;
+    if (font->num_kernings) {
+        font->kernings = system.arena->push<Font::Kerning>(font->num_kernings);
+        Util::copy_bytes((void *) read_head, font->kernings,
+                         sizeof(Font::Kerning) * font->num_kernings);
+        font->kerning_table = system.arena->push<f32>(256 * 256);
+        for (u32 i = 0; i < 256 * 256; i++)
+            font->kerning_table[i] = 0;
+        for (s64 i = 0; i < font->num_kernings; i++)
+            font->kerning_table[font->kernings[i].key] = font->kernings[i].ammount;
+    }
+}
+
+// Copies the asset out of the file, decompressing it if it's
+// compressed. The blocks are decompressed in parallel.
+static u8 *read_asset(AssetID id) {
+    Header *header = system.headers + id;
+    const u8 *asset = asset_data(id);
+    u8 *data;
+    if (header->compression == Compression::NONE) {
+        Util::allow_allocation();
+        data = Util::push_memory<u8>(header->asset_size);
+        Util::copy_bytes((void *) asset, data, header->asset_size);
+    } else {
+        Util::BlockHeader *blocks = (Util::BlockHeader *) (asset + sizeof(Data));
+        Util::allow_allocation();
+        data = Util::push_memory<u8>(sizeof(Data) + blocks->raw_size);
+        Util::copy_bytes((void *) asset, data, sizeof(Data));
+        std::atomic<bool> failed(false);
+        Util::parallel_for(blocks->num_blocks, 1, [blocks, data, &failed](u32 begin, u32 end) {
+            for (u32 i = begin; i < end; i++)
+                if (!Util::decompress_block(blocks, i, data + sizeof(Data)))
+                    failed = true;
+        });
+        ASSERT(!failed, "The asset file is broken");
+    }
+    release_pages(asset, header->asset_size);
+    return data;
+}
+
+// Puts the asset in place from a copy of it, "asset"
+// points to the start of it in the file or in staging memory.
+static void page_in(AssetID id, const u8 *asset) {
+    Residency *residency = system.residency + id;
+    switch (system.headers[id].type) {
+        case Type::TEXTURE: page_in_texture(id, asset); break;
+        case Type::SOUND: page_in_sound(id, asset); break;
+        case Type::FONT: page_in_font(id, asset); break;
+        default: break;
+    }
+    residency->resident = true;
+    residency->last_used = system.frame;
+}
+
+// Paging an asset in writes the residency, the font arena and the GPU
+// without any locks, so it's only done on the main thread.
 Data *raw_fetch(AssetID id, Type type) {
-    if (system.file_header.number_of_assets < id) {
+    ASSERT(Util::on_main_thread(), "Assets can only be fetched on the main thread");
+    if (system.file_header.number_of_assets <= id) {
         ERR("Invalid asset id (%d)", id);
         HALT_AND_CATCH_FIRE;
         return nullptr;
     }
-    if (type == Type::NONE || system.headers[id].type == type) {
-        return &system.assets[id];
-    } else {
+    if (type != Type::NONE && system.headers[id].type != type) {
         ERR("Not the expected type (%d)", id);
         HALT_AND_CATCH_FIRE;
         return nullptr;
     }
+    Residency *residency = system.residency + id;
+    residency->last_used = system.frame;
+    if (!residency->resident) {
+        if (system.headers[id].compression == Compression::NONE) {
+            page_in(id, asset_data(id));
+            release_pages(asset_data(id), system.headers[id].asset_size);
+        } else {
+            u8 *data = read_asset(id);
+            page_in(id, data);
+            Util::pop_memory(data);
+        }
+    }
+    return &system.assets[id];
 }
 
 Image *fetch_image(AssetID id) {
@@ -29,97 +306,340 @@ Image *fetch_image(AssetID id) {
 }
 
 Font *fetch_font(AssetID id) {
-    return &raw_fetch(id, Type::FONT)->font;
+    Font *font = &raw_fetch(id, Type::FONT)->font;
+    font->texture = fetch_image(font->texture_asset)->id;
+    return font;
 }
 
 Sound *fetch_sound(AssetID id) {
     return &raw_fetch(id, Type::SOUND)->sound;
 }
 
-template <typename T>
-size_t read_from_file(FILE *stream, void *ptr, size_t num = 1) {
-    if (!num) {
-        ERR("Has to read something from file, invalid read");
-        return 0;
+void set_residency_budget(u32 texture_slices, u64 sound_bytes) {
+    ASSERT(0 < texture_slices && texture_slices <= OPENGL_TEXTURE_DEPTH,
+           "Invalid number of texture slices");
+    for (u32 slice = texture_slices; slice < OPENGL_TEXTURE_DEPTH; slice++) {
+        s64 owner = system.slice_owner[slice];
+        if (owner == ASSET_ID_NO_ASSET) continue;
+        system.residency[owner].resident = false;
+        system.residency[owner].slice = NO_SLICE;
+        system.slice_owner[slice] = ASSET_ID_NO_ASSET;
+    }
+    system.texture_budget = texture_slices;
+    system.sound_budget = sound_bytes;
+    evict_sounds(0);
+}
+
+void retain_sound(AssetID id) {
+    ASSERT(system.residency[id].resident, "Retaining a sound that isn't in memory");
+    system.residency[id].users.fetch_add(1, std::memory_order_relaxed);
+}
+
+void release_sound(AssetID id) {
+    system.residency[id].users.fetch_sub(1, std::memory_order_release);
+}
+
+void end_frame() {
+    system.frame++;
+}
+
+static void loader_loop() {
+    while (true) {
+        AssetID id;
+        {
+            std::unique_lock<std::mutex> guard(loader.lock);
+            // Waits for room in staging, so the loader can't run away
+            // from the main thread.
+            loader.wake.wait(guard, []() {
+                u32 next = (loader.staged_tail + 1) % Loader::QUEUE_SIZE;
+                return !loader.running ||
+                       (loader.request_head != loader.request_tail &&
+                        next != loader.staged_head);
+            });
+            if (!loader.running) return;
+            id = loader.requests[loader.request_head];
+            loader.request_head = (loader.request_head + 1) % Loader::QUEUE_SIZE;
+        }
+
+        // This is where the disk is read.
+        u8 *data = read_asset(id);
+
+        std::lock_guard<std::mutex> guard(loader.lock);
+        loader.staged[loader.staged_tail] = {id, data};
+        loader.staged_tail = (loader.staged_tail + 1) % Loader::QUEUE_SIZE;
+    }
+}
+
+static Sound sound_info(AssetID id) {
+    Sound sound;
+    Util::copy_bytes((void *) asset_data(id), &sound, sizeof(Sound));
+    return sound;
+}
+
+bool is_streamed(AssetID id) {
+    ASSERT(id < system.file_header.number_of_assets, "Invalid asset id");
+    return system.headers[id].type == Type::SOUND &&
+           sound_info(id).size > STREAM_MIN_SIZE;
+}
+
+// Reads the segment into one half of the window.
+static void fill_segment(SoundStream *stream, u32 half, s64 segment) {
+    stream->loaded[half].store(SoundStream::NO_SEGMENT, std::memory_order_release);
+    u8 *out = stream->window + half * SoundStream::SEGMENT_SIZE;
+    const u8 *body = asset_data(stream->id) + sizeof(Data);
+    if (system.headers[stream->id].compression == Compression::NONE) {
+        u64 begin = segment * SoundStream::SEGMENT_SIZE;
+        u64 size = MIN(SoundStream::SEGMENT_SIZE, stream->sound.size - begin);
+        Util::copy_bytes((void *) (body + begin), out, size);
+        release_pages(body + begin, size);
+    } else {
+        Util::BlockHeader *blocks = (Util::BlockHeader *) body;
+        bool ok = Util::decompress(blocks->block(segment), blocks->block_size(segment),
+                                   out, blocks->raw_block_size(segment));
+        ASSERT(ok, "The asset file is broken");
+        release_pages(blocks->block(segment), blocks->block_size(segment));
+    }
+    stream->loaded[half].store(segment, std::memory_order_release);
+}
+
+// Makes sure the segment after the one that's playing is read in.
+// The half the audio thread reads from is never written to.
+static void refill_stream(SoundStream *stream) {
+    s64 playing = stream->playing.load(std::memory_order_acquire);
+    s64 next = (playing + 1) % stream->num_segments;
+    s32 half = -1;
+    for (u32 i = 0; i < 2; i++)
+        if (stream->loaded[i].load(std::memory_order_acquire) == playing)
+            half = i;
+    if (half == -1) {
+        // The audio thread is ahead, it plays silence until this is done.
+        fill_segment(stream, stream->loaded[0].load() == next, playing);
+        return;
+    }
+    u32 other = 1 - half;
+    if (next != playing && stream->loaded[other].load() != next)
+        fill_segment(stream, other, next);
+}
+
+static void streamer_loop() {
+    while (true) {
+        for (u32 i = 0; i < MAX_STREAMS; i++) {
+            SoundStream *stream = streamer.streams + i;
+            u32 state = stream->state.load(std::memory_order_acquire);
+            if (state == SoundStream::STOPPED)
+                stream->state.store(SoundStream::FREE, std::memory_order_release);
+            else if (state == SoundStream::PLAYING)
+                refill_stream(stream);
+        }
+        std::unique_lock<std::mutex> guard(streamer.lock);
+        if (!streamer.running) return;
+        // A segment is at least a tenth of a second, so
+        // checking often enough is cheap.
+        streamer.wake.wait_for(guard, std::chrono::milliseconds(5));
+    }
+}
+
+SoundStream *open_stream(AssetID id) {
+    ASSERT(is_streamed(id), "Sound isn't streamed");
+    SoundStream *stream = nullptr;
+    for (u32 i = 0; i < MAX_STREAMS && !stream; i++)
+        if (streamer.streams[i].state.load(std::memory_order_acquire) == SoundStream::FREE)
+            stream = streamer.streams + i;
+    if (!stream) return nullptr;
+
+    stream->id = id;
+    stream->sound = sound_info(id);
+    stream->sound.data = nullptr;
+    stream->num_segments = (stream->sound.size + SoundStream::SEGMENT_SIZE - 1) /
+                           SoundStream::SEGMENT_SIZE;
+    stream->playing.store(0);
+    // The start is read in here, so the sound can start straight away.
+    fill_segment(stream, 0, 0);
+    stream->loaded[1].store(SoundStream::NO_SEGMENT);
+    if (stream->num_segments > 1)
+        fill_segment(stream, 1, 1);
+    stream->state.store(SoundStream::PLAYING, std::memory_order_release);
+    return stream;
+}
+
+void close_stream(SoundStream *stream) {
+    stream->state.store(SoundStream::STOPPED, std::memory_order_release);
+}
+
+const u8 *stream_frame(SoundStream *stream, u64 index, bool wait) {
+    u32 frame_size = (1 + stream->sound.is_stereo) * stream->sound.bits_per_sample / 8;
+    u64 offset = index * frame_size;
+    s64 segment = offset / SoundStream::SEGMENT_SIZE;
+    if (stream->playing.load(std::memory_order_relaxed) != segment) {
+        stream->playing.store(segment, std::memory_order_release);
+        streamer.wake.notify_one();
     }
-    size_t read = 0;
     do {
-        size_t last_read = fread(ptr, sizeof(T), num - read, stream);
-        ASSERT(last_read, "Failed to read anything from asset file.");
-        read += last_read;
-        ptr = (void *) ((u8 *) ptr + last_read * sizeof(T));
-    } while (read < num);
-    return read;
+        for (u32 half = 0; half < 2; half++) {
+            if (stream->loaded[half].load(std::memory_order_acquire) != segment) continue;
+            return stream->window + half * SoundStream::SEGMENT_SIZE +
+                   offset % SoundStream::SEGMENT_SIZE;
+        }
+        if (wait) std::this_thread::yield();
+    } while (wait);
+    return nullptr;
 }
 
-bool load(const char *file_path) {
+static void start_loader() {
+    loader.running = true;
+    loader.thread = std::thread(loader_loop);
+
+    for (u32 i = 0; i < MAX_STREAMS; i++) {
+        SoundStream *stream = streamer.streams + i;
+        stream->window = system.arena->push<u8>(2 * SoundStream::SEGMENT_SIZE);
+        stream->state.store(SoundStream::FREE);
+    }
+    streamer.running = true;
+    streamer.thread = std::thread(streamer_loop);
+    // The threads have to be stopped before they're destroyed.
+    atexit(stop_loader);
+}
+
+void stop_loader() {
+    if (!loader.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> guard(loader.lock);
+        loader.running = false;
+    }
+    loader.wake.notify_all();
+    loader.thread.join();
+
+    {
+        std::lock_guard<std::mutex> guard(streamer.lock);
+        streamer.running = false;
+    }
+    streamer.wake.notify_all();
+    streamer.thread.join();
+}
+
+LoadHandle load_async(AssetID id) {
+    return load_async(&id, 1);
+}
+
+LoadHandle load_async(const AssetID *ids, u32 count) {
+    LoadHandle handle = {0};
+    for (u32 i = 0; i < count; i++) {
+        AssetID id = ids[i];
+        ASSERT(id < system.file_header.number_of_assets, "Invalid asset id");
+        Residency *residency = system.residency + id;
+        residency->last_used = system.frame;
+        if (residency->resident) continue;
+        if (residency->ticket > loader.completed) {
+            handle.ticket = MAX(handle.ticket, residency->ticket);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(loader.lock);
+        u32 next = (loader.request_tail + 1) % Loader::QUEUE_SIZE;
+        if (next == loader.request_head) {
+            // The queue is full, so it's loaded right away instead.
+            guard.unlock();
+            raw_fetch(id, Type::NONE);
+            continue;
+        }
+        loader.requests[loader.request_tail] = id;
+        loader.request_tail = next;
+        residency->ticket = ++loader.issued;
+        handle.ticket = residency->ticket;
+    }
+    loader.wake.notify_one();
+    return handle;
+}
+
+bool is_loaded(LoadHandle handle) {
+    return handle.ticket <= loader.completed;
+}
+
+u32 pump_uploads(u32 max_uploads) {
+    u32 uploads = 0;
+    while (uploads < max_uploads) {
+        Staged staged;
+        {
+            std::lock_guard<std::mutex> guard(loader.lock);
+            if (loader.staged_head == loader.staged_tail) break;
+            staged = loader.staged[loader.staged_head];
+            loader.staged_head = (loader.staged_head + 1) % Loader::QUEUE_SIZE;
+        }
+        loader.wake.notify_one();
+        loader.completed++;
+
+        // It might have been fetched while it was loading.
+        if (!system.residency[staged.id].resident) {
+            page_in(staged.id, staged.data);
+            uploads++;
+        }
+        Util::pop_memory(staged.data);
+    }
+    return uploads;
+}
+
+bool load(const char *file_path, bool upload_shaders=true) {
     system.arena = Util::request_arena();
-    FILE *file = fopen(file_path, "rb");
-    if (!file) {
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
         ERR("Failed to open resource file!");
         return false;
     }
+    struct stat info;
+    fstat(fd, &info);
+    system.file_size = info.st_size;
+    system.file = (u8 *) mmap(nullptr, system.file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (system.file == MAP_FAILED) {
+        ERR("Failed to map resource file!");
+        return false;
+    }
 
-    read_from_file<FileHeader>(file, &system.file_header);
+    const u8 *read_head = system.file;
+    Util::copy_bytes((void *) read_head, &system.file_header, sizeof(FileHeader));
+    read_head += sizeof(FileHeader);
     u32 num_assets = system.file_header.number_of_assets;
 
     system.headers = system.arena->push<Header>(num_assets);
-    read_from_file<Header>(file, system.headers, num_assets);
+    Util::copy_bytes((void *) read_head, system.headers, sizeof(Header) * num_assets);
+    read_head += sizeof(Header) * num_assets;
 
     system.strings = system.arena->push<char>(
         system.file_header.size_of_strings);
-    read_from_file<Header>(file, system.strings,
-                                system.file_header.size_of_strings);
+    Util::copy_bytes((void *) read_head, system.strings,
+                     system.file_header.size_of_strings);
 
-    char *read_head = system.strings;
     for (u64 asset = 0; asset < num_assets; asset++)
-        system.headers[asset].file_path += (u64) read_head;
+        system.headers[asset].file_path += (u64) system.strings;
 
-    system.assets = system.arena->push<Data>(
-        system.file_header.number_of_assets);
+    system.assets = system.arena->push<Data>(num_assets);
+    system.residency = system.arena->push<Residency>(num_assets);
     for (u64 asset = 0; asset < num_assets; asset++) {
+        system.residency[asset].resident = false;
+        system.residency[asset].slice = NO_SLICE;
+        system.residency[asset].last_used = 0;
+        system.residency[asset].ticket = 0;
+        system.residency[asset].users.store(0);
+    }
+    for (u32 slice = 0; slice < OPENGL_TEXTURE_DEPTH; slice++)
+        system.slice_owner[slice] = ASSET_ID_NO_ASSET;
+    system.texture_budget = OPENGL_TEXTURE_DEPTH;
+    system.sound_budget = 64 * 1024 * 1024;
+
+    // Shaders are needed straight away, everything
+    // else is read in when it's used. Without a renderer
+    // there's nothing to upload them to.
+    for (u64 asset = 0; asset < num_assets && upload_shaders; asset++) {
         Header header = system.headers[asset];
-        Data *asset_ptr = &system.assets[asset];
-        fseek(file, header.offset, SEEK_SET);
-        read_from_file<Data>(file, asset_ptr);
-        switch (header.type) {
-        case Type::TEXTURE: {
-            u64 size = asset_ptr->image.size();
-            asset_ptr->image.data = Util::push_memory<u8>(size);
-            read_from_file<u8>(file, asset_ptr->image.data, size);
-            Renderer::upload_texture(asset_ptr->image, asset_ptr->image.id);
-            Util::pop_memory(asset_ptr->image.data);
-        } break;
-        case Type::FONT: {
-            asset_ptr->font.glyphs =
-                system.arena->push<Font::Glyph>(asset_ptr->font.num_glyphs);
-            read_from_file<Font::Glyph>(file, asset_ptr->font.glyphs,
-                                        asset_ptr->font.num_glyphs);
-            if (asset_ptr->font.num_kernings) {
-                asset_ptr->font.kernings =
-                    system.arena->push<Font::Kerning>(asset_ptr->font.num_kernings);
-                read_from_file<Font::Glyph>(file, asset_ptr->font.kernings,
-                        asset_ptr->font.num_kernings);
-            }
-        } break;
-        case Type::SOUND: {
-            asset_ptr->sound.data = system.arena->push<u8>(asset_ptr->sound.size);
-            read_from_file<u8>(file, asset_ptr->sound.data, asset_ptr->sound.size);
-        } break;
-        case Type::SHADER: {
-            fseek(file, header.offset, SEEK_SET);
-            u64 size = header.asset_size;
-            char *src = Util::push_memory<char>(size);
-            read_from_file<char>(file, src, size);
-
-            Renderer::upload_shader(header.asset_id, src);
-            Util::pop_memory(src);
-        } break;
-        default:
-            ERR("UNKOWN ASSET TYPE %d", header.type);
-            break;
-        };
+        if (header.type != Type::SHADER) continue;
+        u64 size = header.asset_size;
+        char *src = Util::push_memory<char>(size);
+        Util::copy_bytes((void *) asset_data(asset), src, size);
+        Renderer::upload_shader(header.asset_id, src);
+        Util::pop_memory(src);
+        system.residency[asset].resident = true;
     }
+    start_loader();
     return true;
 }
 
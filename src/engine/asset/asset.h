@@ -1,4 +1,5 @@
 #include "../util/types.h"
+#include <atomic>
 
 
 namespace Asset {
@@ -19,6 +20,14 @@ namespace Asset {
 // "src/fog_assets.cpp", and remember to write the name of the asset, since the
 // actual number might change randomly
 // </p>
+// <p>
+// The asset file is mapped when the engine starts, but nothing is read from
+// it until an asset is fetched the first time. Textures are given a slice on
+// the GPU when they're needed, and sounds are read into memory when they're
+// played. If there isn't room, the asset that was used the longest time ago
+// is thrown out, textures used this frame and sounds that are playing are
+// never thrown out.
+// </p>
 
 ///* AssetID
 // An AssetID is a simple and easy way to identify an asset, they are unique
@@ -46,6 +55,13 @@ struct FileHeader {
     u64 size_of_data;
 };
 
+enum class Compression : u32 {
+    NONE,
+    // The data after the Data struct is compressed with
+    // "Util::compress_blocks".
+    BLOCKS,
+};
+
 struct Header {
     // Relative pointer until "rebuild_pointers".
     Type type;
@@ -55,6 +71,7 @@ struct Header {
     u64 offset;
     u32 asset_size;
     u32 asset_id;
+    Compression compression;
 };
 
 // NOTE(ed): Only ASCII is supported.
@@ -76,34 +93,23 @@ struct Font {
         }
     };
 
-    f32 find_kerning(char a, char b) {
-        u16 key = (a << 8) | b;
-        s64 low = 0;
-        s64 high = num_kernings;
-        s64 last_guess = -1;
-        while (low <= high) {
-            s64 cur = (low + high) / 2;
-            if (cur < 0 || num_kernings < cur || cur == last_guess)
-                break;
-            last_guess = cur;
-            u16 cur_key = kernings[cur].key;
-            if (cur_key > key)
-                high = cur + 1;
-            else if (cur_key < key)
-                low = cur + 1;
-            else
-                return kernings[cur].ammount;
-        }
-        return 0;
+    // The kerning between two glyphs, it's zero for most pairs.
+    f32 find_kerning(u8 a, u8 b) const {
+        if (!kerning_table) return 0;
+        return kerning_table[(a << 8) | b];
     }
 
+    // The slice on the GPU, only valid after "fetch_font".
     u64 texture;
+    AssetID texture_asset;
     f32 height;
     const s64 num_glyphs = 256;
     s64 num_kernings;
 
     Glyph *glyphs;
     Kerning *kernings;
+    // Every pair of glyphs has a slot, built when the font is paged in.
+    f32 *kerning_table;
 };
 
 struct Data {
@@ -122,7 +128,8 @@ struct Data {
 // if it is an image is returned via pointer. It is
 // not recommended to modify any data received from the
 // asset system, as multiple threads could be reading
-// from it and it's bound to cause headaches.
+// from it and it's bound to cause headaches. Fetching can
+// upload the image, so it has to be done on the main thread.
 Image *fetch_image(AssetID id);
 
 ///*
@@ -130,9 +137,121 @@ Image *fetch_image(AssetID id);
 // if it is an image is returned via pointer. It is
 // not recommended to modify any data received from the
 // asset system, as multiple threads could be reading
-// from it and it's bound to cause headaches.
+// from it and it's bound to cause headaches. Fetching can
+// read the font in, so it has to be done on the main thread.
 Font *fetch_font(AssetID id);
 
+///*
+// Checks if the passed in "id" is mapped to a sound,
+// the sound is read in if it isn't in memory, which is
+// done on the calling thread, so only call it from the
+// main thread.
+Sound *fetch_sound(AssetID id);
+
+///*
+// Sets how many texture slices and how many bytes of sound
+// can be used by the assets, the defaults are all slices and
+// 64 MB of sound.
+void set_residency_budget(u32 texture_slices, u64 sound_bytes);
+
+///*
+// Keeps the sound in memory until it's released, the mixer does
+// this for every sound that's playing.
+void retain_sound(AssetID id);
+
+///*
+// Lets the sound be thrown out again, this is safe to
+// call from the audio thread.
+void release_sound(AssetID id);
+
+// Called once at the end of every frame.
+void end_frame();
+
+///* LoadHandle
+// Returned when assets are loaded in the background,
+// check it with "is_loaded".
+struct LoadHandle {
+    u64 ticket;
+};
+
+///*
+// Starts reading in the asset on the loader thread, it's put in
+// place by "pump_uploads". A fetch of an asset that hasn't finished
+// loading reads it in straight away.
+LoadHandle load_async(AssetID id);
+
+///*
+// Starts reading in all the assets, the handle is done when all
+// of them are loaded. Useful when changing levels.
+LoadHandle load_async(const AssetID *ids, u32 count);
+
+///*
+// Returns true if the assets the handle was made for are loaded.
+bool is_loaded(LoadHandle handle);
+
+///*
+// Puts at most "max_uploads" of the assets the loader has read in
+// place, textures are sent to the GPU here. This is called once a
+// frame by the engine, and returns the number of assets put in place.
+u32 pump_uploads(u32 max_uploads=4);
+
+// Stops the loader threads.
+void stop_loader();
+
+///* SoundStream
+// A long sound that is played from a small window instead of being
+// read in whole. The window holds two segments, the audio thread reads
+// from one while a background thread fills the other.
+struct SoundStream {
+    // The same as the compressed blocks, so a segment is one block.
+    static constexpr u32 SEGMENT_SIZE = 1 << 16;
+    static constexpr s64 NO_SEGMENT = -1;
+
+    enum State : u32 {
+        FREE,
+        PLAYING,
+        // Set by the audio thread when it's done, the
+        // streaming thread frees it.
+        STOPPED,
+    };
+
+    std::atomic<u32> state;
+    AssetID id;
+    // The data pointer isn't used.
+    Sound sound;
+    u32 num_segments;
+    u8 *window;
+
+    // The segment in each half of the window, and the
+    // segment the audio thread is reading.
+    std::atomic<s64> loaded[2];
+    std::atomic<s64> playing;
+};
+
+// Sounds larger than this are streamed.
+constexpr u64 STREAM_MIN_SIZE = 1 << 20;
+constexpr u32 MAX_STREAMS = 8;
+
+///*
+// Returns true if the sound is played through a SoundStream.
+bool is_streamed(AssetID id);
+
+///*
+// Starts streaming the sound, the first part of it is read in before
+// this returns. Returns nullptr if all streams are in use.
+SoundStream *open_stream(AssetID id);
+
+///*
+// Stops the stream, this is safe to call from the audio thread.
+void close_stream(SoundStream *stream);
+
+///*
+// Returns the frame of the sound at "index", or nullptr if that
+// part of the sound isn't read in yet. If "wait" is set it waits
+// for the streamer instead, which is only done when the sound is
+// mixed offline. Only called by the audio thread.
+const u8 *stream_frame(SoundStream *stream, u64 index, bool wait=false);
+
 };  // namespace Asset
 
 using AssetID = Asset::AssetID;
@@ -1,17 +1,36 @@
 namespace Logic {
 
     bool init_entity() {
-        // This limits the memory to one arena, just to keep
-        // tabs on the memory, if you trust this code switch it
-        // to true to have UNLIMITED entities.
-        _fog_es.memory = Util::request_arena(false);
-        _fog_es.next_free = 0;
-        _fog_es.entities = Util::create_list<Entity *>(100),
+        // The pools are created when the first entity
+        // of that type is added.
+        for (u32 i = 0; i < _NUM_ENTITY_TYPES; i++)
+            _fog_es.pools[i] = {};
+        _fog_es.entities = Util::create_list<Entity *>(100);
+        memset(_fog_es.entities.data, 0, _fog_es.entities.capacity * sizeof(Entity *));
+        SlotTable *table = Util::push_memory<SlotTable>();
+        *table = {_fog_es.entities.data, _fog_es.entities.capacity};
+        _fog_es.slot_table = table;
+        _fog_es.generations = Util::create_list<u32>(100);
+        _fog_es.free_slots = Util::create_list<s32>(100);
         _fog_es.max_entity = -1;
+        _fog_es.num_slots = 0;
         _fog_es.num_entities = 0;
-        _fog_es.num_removed = 0;
         _fog_es.defrag_limit = 100;
 
+        _fog_es.defrag_bytes_per_frame = 1 << 16;
+        _fog_es.defrag_time_budget = 1000;
+        _fog_es.defrag_moved_bytes = 0;
+        _fog_es.defrag_moved_entities = 0;
+
+        _fog_es.deferring = false;
+        _fog_es.pending_adds = Util::create_list<Entity *>(32);
+        _fog_es.pending_removes = Util::create_list<Entity *>(32);
+        _fog_es.pending_calls.clear();
+
+        _fog_es.parallel = false;
+        _fog_es.retired_tables = Util::create_list<SlotTable *>(4);
+        _fog_es.parallel_chunk_size = 256;
+
         _fog_global_type_table.arena = Util::request_arena();
         return true;
     }
@@ -113,59 +132,205 @@ namespace Logic {
 
 
     // ES
+    EntityPool *pool_for(EntityType type) {
+        EntityPool *pool = _fog_es.pools + (u32) type;
+        if (!pool->stride) {
+            pool->stride = meta_data_for(type).size;
+            Util::allow_allocation();
+            pool->free = Util::create_list<u32>(32);
+        }
+        return pool;
+    }
+
+    void grow_pool(EntityPool *pool) {
+        ASSERT(pool->capacity <= ((u32) -1) / 2, "The entity pool is full");
+        u32 capacity = pool->capacity ? pool->capacity * 2 : 32;
+        Util::allow_allocation();
+        pool->memory = Util::resize_memory<u8>(pool->memory, capacity * pool->stride);
+        ASSERT(pool->memory, "Failed to grow entity pool");
+        Util::allow_allocation();
+        pool->dirty = Util::resize_memory<u64>(pool->dirty, capacity);
+        if (_fog_global_entity_list[pool - _fog_es.pools].track_changes) {
+            Util::allow_allocation();
+            pool->shadow = Util::resize_memory<u8>(pool->shadow, capacity * pool->stride);
+        }
+        pool->capacity = capacity;
+        // The memory might have moved.
+        for (u32 i = 0; i < pool->length; i++) {
+            Entity *e = pool->get(i);
+            if (e->id.slot < 0) continue;
+            _fog_es.entities[e->id.slot] = e;
+        }
+    }
+
+    // Makes sure "count" more entities fit without growing.
+    void reserve_pool(EntityPool *pool, u32 count) {
+        while (pool->capacity - pool->num_alive < count)
+            grow_pool(pool);
+    }
+
+    // Returns uninitalized memory for an entity of the type.
+    Entity *pool_alloc(EntityType type) {
+        EntityPool *pool = pool_for(type);
+        pool->num_alive++;
+        u32 index = pool->length;
+        while (pool->free.length) {
+            u32 hole = pool->free.pop();
+            if (hole < pool->length && pool->is_hole(hole)) {
+                index = hole;
+                break;
+            }
+        }
+        if (index == pool->length) {
+            if (pool->length == pool->capacity)
+                grow_pool(pool);
+            pool->length++;
+        }
+        pool->dirty[index] = ALL_FIELDS;
+        return pool->get(index);
+    }
+
+    void pool_free(EntityType type, Entity *entity) {
+        EntityPool *pool = pool_for(type);
+        u32 index = ((u8 *) entity - pool->memory) / pool->stride;
+        ASSERT(index < pool->length, "Entity is not in this pool");
+        entity->id = invalid_id();
+        pool->num_alive--;
+        Util::allow_allocation();
+        pool->free.append(index);
+    }
+
+    void grow_slot_table(u32 capacity) {
+        u32 old_capacity = _fog_es.entities.capacity;
+        Util::allow_allocation();
+        if (!_fog_es.parallel) {
+            _fog_es.entities.resize(capacity);
+            memset(_fog_es.entities.data + old_capacity, 0,
+                   (capacity - old_capacity) * sizeof(Entity *));
+            SlotTable *table = _fog_es.slot_table.load(std::memory_order_relaxed);
+            *table = {_fog_es.entities.data, capacity};
+            return;
+        }
+        // Other threads might be reading the table, so the old
+        // one is kept around until the flush.
+        Entity **entities = Util::push_memory<Entity *>(capacity);
+        Util::copy_bytes(_fog_es.entities.data, entities,
+                         old_capacity * sizeof(Entity *));
+        memset(entities + old_capacity, 0, (capacity - old_capacity) * sizeof(Entity *));
+        Util::allow_allocation();
+        SlotTable *table = Util::push_memory<SlotTable>();
+        *table = {entities, capacity};
+        Util::allow_allocation();
+        _fog_es.retired_tables.append(_fog_es.slot_table);
+        _fog_es.entities.data = entities;
+        _fog_es.entities.capacity = capacity;
+        _fog_es.slot_table.store(table, std::memory_order_release);
+    }
+
     EntityID generate_entity_id() {
         EntityID id;
         _fog_es.num_entities++;
-        if (_fog_es.next_free < 0) {
-            // Reusing
-            id.slot = -_fog_es.next_free - 1;
-            _fog_es.next_free = _fog_es.entities[id.slot]->id.slot;
+        if (_fog_es.free_slots.length) {
+            id.slot = _fog_es.free_slots.pop();
         } else {
-            id.slot = _fog_es.next_free++;
-            id.gen = 0;
-        }
-
-        if ((s32) _fog_es.entities.capacity <= id.slot) {
-            _fog_es.entities.resize(id.slot * 2);
+            id.slot = _fog_es.num_slots++;
+            if ((s32) _fog_es.entities.capacity <= id.slot) {
+                grow_slot_table(id.slot * 2);
+                Util::allow_allocation();
+                _fog_es.generations.resize(id.slot * 2);
+            }
+            _fog_es.generations[id.slot] = 0;
         }
-
-        id.gen++;
+        id.gen = ++_fog_es.generations[id.slot];
 
         _fog_es.max_entity = MAX(id.slot, _fog_es.max_entity);
         return id;
     }
 
+    // Entities added while deferring are kept on the side until
+    // they're flushed, so the pools don't move. Frame memory can't
+    // be used, since this might run on a worker.
+    EntityID defer_add(Entity *entity, u32 size) {
+        std::unique_lock<std::mutex> guard(_fog_es.command_lock, std::defer_lock);
+        if (_fog_es.parallel) guard.lock();
+        EntityID id = generate_entity_id();
+        entity->id = id;
+        Util::allow_allocation();
+        Entity *staged = (Entity *) Util::push_memory<u8>(size);
+        Util::copy_bytes(entity, staged, size);
+        Util::allow_allocation();
+        _fog_es.pending_adds.append(staged);
+        return id;
+    }
+
     template<typename T>
     EntityID add_entity(T entity) {
         static_assert(std::is_base_of<Entity, T>(),
                       "You supplied a class that isn't based on Logic::Entity");
+        ASSERT(meta_data_for(T::st_type()).size == sizeof(T),
+               "Entity size doesn't match the registered size");
+        if (_fog_es.deferring)
+            return defer_add(&entity, sizeof(T));
         EntityID id = generate_entity_id();
         entity.id = id;
-        Util::allow_allocation();
-        _fog_es.entities[id.slot] = _fog_es.memory->push(entity);
-        ASSERT((u64) _fog_es.entities[id.slot] > 1000, "Invalid pointer in entity system.");
-        Util::strict_allocation_check();
+        Entity *slot = pool_alloc(T::st_type());
+        Util::copy_bytes(&entity, slot, sizeof(T));
+        _fog_es.entities[id.slot] = slot;
         return id;
     }
 
     EntityID add_entity_ptr(Entity *entity) {
+        u32 size = Logic::fetch_entity_type(entity->type())->size;
+        if (_fog_es.deferring)
+            return defer_add(entity, size);
         EntityID id = generate_entity_id();
         entity->id = id;
 
-        u32 size = Logic::fetch_entity_type(entity->type())->size;
-        Util::allow_allocation();
-        Entity *copy = (Entity *) _fog_es.memory->push<u8>(size);
-        Util::strict_allocation_check();
+        Entity *copy = pool_alloc(entity->type());
         Util::copy_bytes(entity, copy, size);
-        _fog_es.entities[id.slot] = entity;
-        ASSERT((u64) _fog_es.entities[id.slot] > 1000, "Invalid pointer in entity system.");
+        _fog_es.entities[id.slot] = copy;
 
         return id;
     }
 
+    u8 *reserve_entities(EntityType type, u32 count) {
+        EntityPool *pool = pool_for(type);
+        while (pool->capacity - pool->length < count)
+            grow_pool(pool);
+        return (u8 *) pool->get(pool->length);
+    }
+
+    void add_entities_bulk(EntityType type, u32 count) {
+        ASSERT(!_fog_es.deferring, "Cannot add entities in bulk while iterating over them");
+        EntityPool *pool = pool_for(type);
+        ASSERT(pool->length + count <= pool->capacity,
+               "Not enough room reserved for the entities");
+
+        s32 last_slot = _fog_es.num_slots + count - _fog_es.free_slots.length;
+        if ((s32) _fog_es.entities.capacity <= last_slot) {
+            grow_slot_table(last_slot * 2);
+            Util::allow_allocation();
+            _fog_es.generations.resize(last_slot * 2);
+        }
+
+        void *vtable = _entity_vtable(type);
+        for (u32 i = 0; i < count; i++) {
+            u32 index = pool->length++;
+            Entity *entity = pool->get(index);
+            *((void **) entity) = vtable;
+            entity->id = generate_entity_id();
+            _fog_es.entities[entity->id.slot] = entity;
+            pool->dirty[index] = ALL_FIELDS;
+        }
+        pool->num_alive += count;
+    }
+
     Entity *fetch_entity(EntityID id) {
-        if (id.slot >= 0) {
-            Entity *entity = _fog_es.entities[id.slot];
+        // Might be called during a parallel update, while another
+        // thread grows the table.
+        SlotTable *table = _fog_es.slot_table.load(std::memory_order_acquire);
+        if (0 <= id.slot && (u32) id.slot < table->capacity) {
+            Entity *entity = table->entities[id.slot];
             if (entity && id == entity->id) return entity;
         }
         return nullptr;
@@ -183,30 +348,202 @@ namespace Logic {
         return fetch_entity(id) != nullptr;
     }
 
+    void release_entity(Entity *entity) {
+        Util::allow_allocation();
+        _fog_es.free_slots.append(entity->id.slot);
+        // The memory is left as is, except for the id, so the entity
+        // can still be read until the slot is reused.
+        pool_free(entity->type(), entity);
+    }
+
     bool remove_entity(EntityID id) {
         Entity *entity = fetch_entity(id);
         if (!entity) return false;
+        if (_fog_es.parallel) {
+            // Unlinked in the flush, since other threads
+            // might be looking at the slot table.
+            std::lock_guard<std::mutex> guard(_fog_es.command_lock);
+            Util::allow_allocation();
+            _fog_es.pending_removes.append(entity);
+            return true;
+        }
         _fog_es.num_entities--;
-        _fog_es.num_removed++;
-
-        s32 slot = entity->id.slot;
-        entity->id.slot = _fog_es.next_free;
-        _fog_es.next_free = -slot - 1;
 
-        if (slot == _fog_es.max_entity) {
-            while (_fog_es.entities[_fog_es.max_entity]->id.slot < 0 &&
-                   0 <= _fog_es.max_entity)
-                _fog_es.max_entity--;
+        _fog_es.entities[id.slot] = nullptr;
+        if (_fog_es.deferring) {
+            Util::allow_allocation();
+            _fog_es.pending_removes.append(entity);
+        } else {
+            release_entity(entity);
         }
+
+        while (0 <= _fog_es.max_entity &&
+               !_fog_es.entities[_fog_es.max_entity])
+            _fog_es.max_entity--;
         return true;
     }
 
+    // Entities that are removed while deferring are still in
+    // the pool, but not in the slot table.
+    bool is_linked(Entity *e) {
+        SlotTable *table = _fog_es.slot_table.load(std::memory_order_acquire);
+        return e->id.slot >= 0 && table->entities[e->id.slot] == e;
+    }
+
+    void defer_call(Function<void()> f) {
+        if (!_fog_es.deferring) {
+            f();
+            return;
+        }
+        std::unique_lock<std::mutex> guard(_fog_es.command_lock, std::defer_lock);
+        if (_fog_es.parallel) guard.lock();
+        _fog_es.pending_calls.push_back(f);
+    }
+
+    void flush_entity_removes() {
+        for (u32 i = 0; i < _fog_es.pending_removes.length; i++) {
+            Entity *entity = _fog_es.pending_removes[i];
+            // Removed more than once from a parallel update.
+            if (entity->id.slot < 0) continue;
+            if (is_linked(entity)) {
+                // Removed from a parallel update.
+                _fog_es.num_entities--;
+                _fog_es.entities[entity->id.slot] = nullptr;
+            }
+            release_entity(entity);
+        }
+        _fog_es.pending_removes.clear();
+
+        while (0 <= _fog_es.max_entity &&
+               !_fog_es.entities[_fog_es.max_entity])
+            _fog_es.max_entity--;
+    }
+
+    void flush_entity_adds() {
+        if (!_fog_es.pending_adds.length) return;
+        u32 count[_NUM_ENTITY_TYPES] = {};
+        for (u32 i = 0; i < _fog_es.pending_adds.length; i++)
+            count[(u32) _fog_es.pending_adds[i]->type()]++;
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            if (count[type])
+                reserve_pool(pool_for((EntityType) type), count[type]);
+        }
+        for (u32 i = 0; i < _fog_es.pending_adds.length; i++) {
+            Entity *staged = _fog_es.pending_adds[i];
+            EntityPool *pool = pool_for(staged->type());
+            Entity *slot = pool_alloc(staged->type());
+            Util::copy_bytes(staged, slot, pool->stride);
+            Util::pop_memory(staged);
+            _fog_es.entities[slot->id.slot] = slot;
+            // The slot might have been passed over when
+            // something else was removed.
+            _fog_es.max_entity = MAX(slot->id.slot, _fog_es.max_entity);
+        }
+        _fog_es.pending_adds.clear();
+    }
+
+    void flush_entity_commands() {
+        ASSERT(!_fog_es.deferring, "Cannot flush while iterating over entities");
+        ASSERT(!_fog_es.parallel, "Cannot flush while updating in parallel");
+        for (u32 i = 0; i < _fog_es.retired_tables.length; i++) {
+            Util::pop_memory(_fog_es.retired_tables[i]->entities);
+            Util::pop_memory(_fog_es.retired_tables[i]);
+        }
+        _fog_es.retired_tables.clear();
+
+        flush_entity_removes();
+        flush_entity_adds();
+
+        // Calls are made last so they see the world as it is after
+        // the update, they're free to add and remove entities.
+        for (u32 i = 0; i < _fog_es.pending_calls.size(); i++)
+            _fog_es.pending_calls[i]();
+        _fog_es.pending_calls.clear();
+    }
+
+    EntityPool *pool_of(Entity *entity) {
+        return _fog_es.pools + (u32) entity->type();
+    }
+
+    u64 field_bit(u32 field) {
+        return ((u64) 1) << MIN(field, 63);
+    }
+
+    void mark_dirty(Entity *entity, u64 fields) {
+        EntityPool *pool = pool_of(entity);
+        pool->dirty[pool->index_of(entity)] |= fields;
+    }
+
+    void mark_field_dirty(Entity *entity, u64 offset) {
+        EMeta *meta = _fog_global_entity_list + (u32) entity->type();
+        for (u32 i = 0; i < meta->num_fields; i++) {
+            if (meta->fields[i].offset == offset) {
+                mark_dirty(entity, field_bit(i));
+                return;
+            }
+        }
+        mark_dirty(entity, ALL_FIELDS);
+    }
+
+    u64 dirty_fields(Entity *entity) {
+        EntityPool *pool = pool_of(entity);
+        return pool->dirty[pool->index_of(entity)];
+    }
+
+    void clear_dirty() {
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EntityPool *pool = _fog_es.pools + type;
+            for (u32 i = 0; i < pool->length; i++)
+                pool->dirty[i] = 0;
+        }
+    }
+
+    void for_dirty_entity(MapFunc f) {
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EntityPool *pool = _fog_es.pools + type;
+            for (u32 i = 0; i < pool->length; i++) {
+                if (!pool->dirty[i]) continue;
+                Entity *e = pool->get(i);
+                if (!is_linked(e)) continue;
+                if (f(e)) return;
+            }
+        }
+    }
+
+    void track_entity_changes() {
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EMeta *meta = _fog_global_entity_list + type;
+            EntityPool *pool = _fog_es.pools + type;
+            if (!meta->track_changes || !pool->length) continue;
+
+            u64 *sizes = Util::request_temporary_memory<u64>(meta->num_fields);
+            for (u32 i = 0; i < meta->num_fields; i++)
+                sizes[i] = fetch_type(meta->fields[i].hash)->size;
+
+            // Each entity only touches its own memory.
+            Util::parallel_for(pool->length, _fog_es.parallel_chunk_size,
+                [pool, meta, sizes](u32 begin, u32 end) {
+                    for (u32 i = begin; i < end; i++) {
+                        u8 *entity = (u8 *) pool->get(i);
+                        if (!is_linked((Entity *) entity)) continue;
+                        u8 *shadow = pool->shadow + i * pool->stride;
+                        for (u32 f = 0; f < meta->num_fields; f++) {
+                            u64 offset = meta->fields[f].offset;
+                            if (!memcmp(entity + offset, shadow + offset, sizes[f]))
+                                continue;
+                            Util::copy_bytes(entity + offset, shadow + offset, sizes[f]);
+                            pool->dirty[i] |= field_bit(f);
+                        }
+                    }
+                });
+        }
+    }
+
     void for_entity_of_type(EntityType type, MapFunc f) {
-        for (s32 i = _fog_es.max_entity; 0 <= i; i--) {
-            Entity *e = _fog_es.entities[i];
-            if (!e) continue;
-            if (e->id.slot != i) continue;
-            if (e->type() != type) continue;
+        EntityPool *pool = _fog_es.pools + (u32) type;
+        for (s32 i = (s32) pool->length - 1; 0 <= i; i--) {
+            Entity *e = pool->get(i);
+            if (!is_linked(e)) continue;
             if (f(e)) break;
         }
     }
@@ -215,76 +552,133 @@ namespace Logic {
         for (s32 i = 0; i <= _fog_es.max_entity; i++) {
             Entity *e = _fog_es.entities[i];
             if (!e) continue;
-            if (e->id.slot != i) continue;
             if (f(e)) break;
         }
     }
 
     EntityID fetch_first_of_type(EntityType type) {
-        for (s32 i = 0; i <= _fog_es.max_entity; i++) {
-            Entity *e = _fog_es.entities[i];
-            if (!e) continue;
-            if (e->id.slot != i) continue;
-            if (e->type() == type) return e->id;
+        EntityPool *pool = _fog_es.pools + (u32) type;
+        for (u32 i = 0; i < pool->length; i++) {
+            Entity *e = pool->get(i);
+            if (!is_linked(e)) continue;
+            return e->id;
         }
         return {-1, 0};
     }
 
+    // The pool doesn't move while it's updated, since all adds
+    // are staged until the flush.
+    void update_pool_parallel(EntityPool *pool, f32 delta) {
+        _fog_es.parallel = true;
+        Util::parallel_for(pool->length, _fog_es.parallel_chunk_size,
+            [pool, delta](u32 begin, u32 end) {
+                for (u32 i = begin; i < end; i++) {
+                    Entity *e = pool->get(i);
+                    if (!is_linked(e)) continue;
+                    e->update(delta);
+                }
+            });
+        _fog_es.parallel = false;
+    }
+
     void update_es() {
         START_PERF(ENTITY_UPDATE);
         const f32 delta = Logic::delta();
-        for (s32 i = 0; i <= _fog_es.max_entity; i++) {
-            Entity *e = _fog_es.entities[i];
-            if (!e) continue;
-            if (e->id.slot != i) continue;
-            e->update(delta);
+        _fog_es.deferring = true;
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EntityPool *pool = _fog_es.pools + type;
+            if (_fog_global_entity_list[type].parallel_update &&
+                Util::num_workers()) {
+                update_pool_parallel(pool, delta);
+                continue;
+            }
+            for (u32 i = 0; i < pool->length; i++) {
+                Entity *e = pool->get(i);
+                if (!is_linked(e)) continue;
+                e->update(delta);
+            }
         }
+        _fog_es.deferring = false;
+        flush_entity_commands();
+        track_entity_changes();
         STOP_PERF(ENTITY_UPDATE);
     }
 
     void draw_es() {
         START_PERF(ENTITY_DRAW);
-        for (s32 i = 0; i <= _fog_es.max_entity; i++) {
-            Entity *e = _fog_es.entities[i];
-            if (!e) continue;
-            if (e->id.slot != i) continue;
-            e->draw();
+        _fog_es.deferring = true;
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EntityPool *pool = _fog_es.pools + type;
+            for (u32 i = 0; i < pool->length; i++) {
+                Entity *e = pool->get(i);
+                if (!is_linked(e)) continue;
+                e->draw();
+            }
         }
+        _fog_es.deferring = false;
+        flush_entity_commands();
         STOP_PERF(ENTITY_DRAW);
     }
 
-    // TODO(ed): Make this doable across multiple frames, so we
-    // can spend 1ms on it everyframe or something like that...
+    // Moves entities from the end of the pool into the holes. Returns
+    // false if it ran out of budget.
+    bool compact_pool(EntityPool *pool, u64 *moved, u64 start) {
+        while (pool->num_alive < pool->length) {
+            if (!pool->is_hole(pool->length - 1)) {
+                if (*moved >= _fog_es.defrag_bytes_per_frame) return false;
+                // Checking the clock is not free, so only do it every so often.
+                if ((_fog_es.defrag_moved_entities & 0xF) == 0xF &&
+                    Perf::highp_now() - start >= _fog_es.defrag_time_budget)
+                    return false;
+
+                // Entities might have been removed behind the cursor since
+                // the last call, there's always a hole before the last one.
+                if (pool->compact_cursor >= pool->length - 1)
+                    pool->compact_cursor = 0;
+                while (!pool->is_hole(pool->compact_cursor)) {
+                    pool->compact_cursor++;
+                    if (pool->compact_cursor >= pool->length - 1)
+                        pool->compact_cursor = 0;
+                }
+
+                Entity *from = pool->get(pool->length - 1);
+                Entity *to = pool->get(pool->compact_cursor);
+                Util::copy_bytes(from, to, pool->stride);
+                _fog_es.entities[to->id.slot] = to;
+                from->id = invalid_id();
+                pool->dirty[pool->compact_cursor] = pool->dirty[pool->length - 1];
+                if (pool->shadow)
+                    Util::copy_bytes(pool->shadow + (pool->length - 1) * pool->stride,
+                                     pool->shadow + pool->compact_cursor * pool->stride,
+                                     pool->stride);
+
+                *moved += pool->stride;
+                _fog_es.defrag_moved_entities++;
+            }
+            pool->length--;
+        }
+        // Everything left in the free list is outside the pool now.
+        pool->free.clear();
+        pool->compacting = false;
+        pool->compact_cursor = 0;
+        return true;
+    }
+
     void defragment_entity_memory() {
         START_PERF(ENTITY_DEFRAG);
-        if (_fog_es.num_removed < _fog_es.defrag_limit) {
-            STOP_PERF(ENTITY_DEFRAG);
-            return;
-        }
-        // This is kinda hacky...
-        Util::allow_allocation();
-        Util::MemoryArena *target_arena = Util::request_arena(false);
-        u64 memory = 0;
-        ASSERT(offsetof(Entity, id) < 16, "Empty entity is quite large");
-        for (s32 i = 0; i <= _fog_es.max_entity; i++) {
-            Entity *e = _fog_es.entities[i];
-            u32 size;
-            if (e->id.slot != i) {
-                size = offsetof(Entity, id) + sizeof(EntityID);
-            } else {
-                size = fetch_type(meta_data_for(e->type()).hash)->size;
+        _fog_es.defrag_moved_bytes = 0;
+        _fog_es.defrag_moved_entities = 0;
+        const u64 start = Perf::highp_now();
+        for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+            EntityPool *pool = _fog_es.pools + type;
+            if (!pool->compacting) {
+                if (pool->length - pool->num_alive < _fog_es.defrag_limit)
+                    continue;
+                pool->compacting = true;
             }
-            memory += size;
-            Util::allow_allocation();
-            u8 *target = target_arena->push<u8>(size);
-            Util::copy_bytes(e, target, size);
-            _fog_es.entities[i] = (Entity *) target;
-            ASSERT((u64) _fog_es.entities[i] > 1000, "Invalid pointer in entity system.");
+            if (!compact_pool(pool, &_fog_es.defrag_moved_bytes, start))
+                break;
         }
-        ASSERT(memory < Util::ARENA_SIZE_IN_BYTES, "Too large allocations");
-        _fog_es.memory->pop();
-        _fog_es.memory = target_arena;
-        _fog_es.num_removed = 0; // We've not removed any now
         STOP_PERF(ENTITY_DEFRAG);
     }
 };
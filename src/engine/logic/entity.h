@@ -1,5 +1,6 @@
 #include <typeindex>
 #include <type_traits>
+#include <vector>
 
 namespace Logic {
 #if 0
@@ -51,6 +52,33 @@ void entity_registration() {
 //    <li>Use it to your hearts content.</li>
 // </ul>
 
+//// Updating in parallel
+// Entity types that only touch their own memory when they're updated can
+// be updated across multiple threads, just say so in the struct.
+struct Particle : public Entity {
+    static constexpr bool parallel_update = true;
+    Vec2 velocity;
+    REGISTER_FIELDS(PARTICLE, Particle, position, velocity)
+};
+// Adding and removing entities is safe from a parallel update, but
+// anything else that touches shared state, like playing sounds or
+// reading random numbers, has to be passed to "Logic::defer_call" so
+// it's run on the main thread after the update. Removed entities stay
+// valid until the update is done.
+
+//// Tracking changes
+// Every entity has a bit for each of its registered fields that is set
+// when the field changes, so a save or a sync only has to look at what
+// changed. Fields set with the SET_FIELD macro are marked automatically.
+SET_FIELD(particle, velocity, V2(1, 0));
+// Types that change a lot of fields all over the place can ask the engine
+// to compare the registered fields after every update instead, this costs
+// a copy of every entity of that type.
+struct Crowd : public Entity {
+    static constexpr bool track_changes = true;
+    ...
+};
+
 #endif
 
 struct EntityID {
@@ -88,6 +116,10 @@ struct EMeta {
     u64 num_fields;
     EField *fields;
     bool registered;
+    // If the entities can be updated on multiple threads.
+    bool parallel_update;
+    // If the fields are compared after each update to find changes.
+    bool track_changes;
 
     const char *show();
 };
@@ -149,6 +181,11 @@ struct Entity {
     // Prints out the enitty.
     const char *show();
 
+    // Override these in a sub class to update the type in parallel
+    // or track changes to the fields automatically.
+    static constexpr bool parallel_update = false;
+    static constexpr bool track_changes = false;
+
     // What the macro generates.
     virtual const char *type_name() { return "BASE"; }
     virtual EntityType type() { return EntityType::BASE; }
@@ -159,7 +196,9 @@ struct Entity {
                 sizeof(Entity),
                 0,
                 nullptr,
-                true};
+                true,
+                false,
+                false};
     }
 };
 
@@ -167,15 +206,92 @@ typedef void *(*EVtableFunc)();
 EVtableFunc _fog_global_entity_vtable[_NUM_ENTITY_TYPES];
 
 
+// All entities of one type live next to each other in a pool,
+// removed entities leave holes that are reused by the next entity
+// of the same type.
+struct EntityPool {
+    // The size of one entity, taken from EMeta.
+    u64 stride;
+    // Number of used slots, including holes.
+    u32 length;
+    u32 capacity;
+    u32 num_alive;
+    u8 *memory;
+    // The changed fields of each entity.
+    u64 *dirty;
+    // A copy of each entity from the last time it was compared,
+    // only used if the type tracks changes.
+    u8 *shadow;
+
+    // Holes that can be reused, an index is only valid if it is
+    // still a hole when it's popped.
+    Util::List<u32> free;
+
+    // Set when the pool has too many holes and is being packed.
+    bool compacting;
+    u32 compact_cursor;
+
+    Entity *get(u32 index) {
+        return (Entity *) (memory + index * stride);
+    }
+
+    u32 index_of(Entity *entity) {
+        return ((u8 *) entity - memory) / stride;
+    }
+
+    bool is_hole(u32 index) {
+        return get(index)->id.slot < 0;
+    }
+};
+
+// The slot table as it's read by "fetch_entity", the table and its
+// capacity are swapped together when it grows during a parallel update,
+// so a thread never sees the size of one table with another.
+struct SlotTable {
+    Entity **entities;
+    u32 capacity;
+};
+
 struct EntitySystem {
-    Util::MemoryArena *memory;
-    s32 next_free;
+    EntityPool pools[_NUM_ENTITY_TYPES];
+
+    // Maps an EntityID slot to where the entity is stored, the slots
+    // that aren't in use are null.
     Util::List<Entity *> entities;
+    std::atomic<SlotTable *> slot_table;
+    Util::List<u32> generations;
+    Util::List<s32> free_slots;
 
     s32 max_entity;
+    s32 num_slots;
     u32 num_entities;
-    u32 num_removed;
+    // Number of holes a pool can have before it's packed.
     u32 defrag_limit;
+
+    u64 defrag_bytes_per_frame;
+    u64 defrag_time_budget; // In microseconds.
+
+    // What the last call to "defragment_entity_memory" did.
+    u64 defrag_moved_bytes;
+    u32 defrag_moved_entities;
+
+    // Adds and removes made while the entities are updated or
+    // drawn are recorded here and applied afterwards.
+    bool deferring;
+    Util::List<Entity *> pending_adds;
+    Util::List<Entity *> pending_removes;
+    std::vector<Function<void()>> pending_calls;
+
+    // Set while a type is updated on multiple threads, the commands
+    // are guarded by the lock and removes are not applied until the
+    // flush.
+    bool parallel;
+    std::mutex command_lock;
+    // Slot tables that were replaced while other threads might
+    // have been reading them.
+    Util::List<SlotTable *> retired_tables;
+    // Number of entities in each job of a parallel update.
+    u32 parallel_chunk_size;
 } _fog_es;
 
 ///*
@@ -196,6 +312,10 @@ void *_entity_vtable(EntityType type);
 ///*
 // Adds an entity to the ES, a copy is made to insert it
 // and a unique id is returned.
+//
+// If this is called while the entities are being updated or
+// drawn, the entity is inserted after all entities are done and
+// the id is not valid until then.
 template<typename T>
 EntityID add_entity(T entity);
 
@@ -204,6 +324,18 @@ EntityID add_entity(T entity);
 // pointer.
 EntityID add_entity_ptr(Entity *entity);
 
+///*
+// Makes room for "count" entities of the type after the last entity
+// in its pool, and returns the memory so it can be filled in directly.
+// Nothing is added until "add_entities_bulk" is called.
+u8 *reserve_entities(EntityType type, u32 count);
+
+///*
+// Adds the "count" entities that were written to the memory from
+// "reserve_entities". The vtables and ids are filled in by the ES.
+// Cannot be called while the entities are updated or drawn.
+void add_entities_bulk(EntityType type, u32 count);
+
 ///*
 // Tries to fetch an entity from the ES, and returns a pointer
 // to it. If the ID is invalid a nullptr is returned.
@@ -222,8 +354,56 @@ bool valid_entity(EntityID id);
 ///*
 // Frees the resources of an entity from the ES to be used
 // later on.
+//
+// If this is called while the entities are being updated or
+// drawn, the id is invalid straight away but the memory is kept
+// until all entities are done. So it is safe for an entity to
+// remove itself.
 bool remove_entity(EntityID id);
 
+///*
+// Calls the function after all entities have been updated or
+// drawn, on the main thread. Use this for anything that touches
+// shared state from an entity that is updated in parallel.
+//
+// If the entities aren't being updated or drawn the function is
+// called straight away.
+void defer_call(Function<void()> f);
+
+///*
+// All fields of an entity, the bit for a field is the index it was
+// registered with. Fields past the 63rd all share the last bit.
+constexpr u64 ALL_FIELDS = ~((u64) 0);
+
+///*
+// Marks the fields as changed. New entities have all their fields
+// marked.
+void mark_dirty(Entity *entity, u64 fields=ALL_FIELDS);
+
+// Marks the field at the byte offset in the entity as changed,
+// if there's no registered field there all fields are marked.
+void mark_field_dirty(Entity *entity, u64 offset);
+
+///*
+// Sets the field on the entity and marks it as changed.
+#define SET_FIELD(entity, field, value)                           \
+    do {                                                          \
+        (entity)->field = (value);                                \
+        Logic::mark_field_dirty(                                  \
+            (entity), (u8 *) &(entity)->field - (u8 *) (entity)); \
+    } while (false)
+
+///*
+// Returns the fields of the entity that have changed since
+// the last call to "clear_dirty".
+u64 dirty_fields(Entity *entity);
+
+///*
+// Clears the changes on all entities. The bits are shared by
+// everything that looks at them, saving the entities in the
+// editor clears them.
+void clear_dirty();
+
 ///* MapFunc
 // The function type for mapping over entities.
 //
@@ -250,6 +430,11 @@ void for_entity_of_type(EntityType type, MapFunc f);
 // if you know where they are.
 void for_entity(MapFunc f);
 
+///*
+// Applies the map function to each entity in the ES that has
+// changed since the last call to "clear_dirty".
+void for_dirty_entity(MapFunc f);
+
 ///*
 // Returns the first entity in the system of the specified
 // type. Returns an invalid id if it fails.
@@ -261,7 +446,22 @@ void update_es();
 // Draws all valid entities.
 void draw_es();
 
-// Restructures the memory to remove potential holes in the allocation.
+// Compares the registered fields of the types that track changes,
+// and marks the ones that changed. Called after the entities are updated.
+void track_entity_changes();
+
+// Applies all adds, removes and calls that were recorded while
+// updating or drawing.
+void flush_entity_commands();
+
+// Packs the pools that have too many holes in them. The work is spread
+// out over multiple frames, each call moves at most "defrag_bytes_per_frame"
+// bytes and spends at most "defrag_time_budget" microseconds.
 void defragment_entity_memory();
 
+// Updates a type in parallel that adds and removes entities every frame,
+// and prints how long the updates took. Returns false if the entities
+// that are left, or their ids, don't match the adds and removes.
+bool run_benchmark();
+
 }
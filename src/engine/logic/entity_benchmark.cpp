@@ -0,0 +1,127 @@
+namespace Logic {
+
+static constexpr u32 BENCHMARK_ENTITIES = 20000;
+static constexpr u32 BENCHMARK_FRAMES = 60;
+
+// The frame that is being updated, only written between the updates.
+static u32 benchmark_frame;
+static std::atomic<u32> benchmark_adds;
+static std::atomic<u32> benchmark_removes;
+static std::atomic<u32> benchmark_bad_lookups;
+
+// Adds and removes entities from a parallel update, and looks up
+// another entity while the slot table might be growing.
+struct BenchmarkEntity : public Entity {
+    static constexpr bool parallel_update = true;
+
+    // The first frame the entity was updated in, and how many
+    // times it has been updated since.
+    u32 born;
+    u32 updates;
+    // The entity that added this one, and the last one this one added.
+    EntityID parent;
+    EntityID child;
+
+    void update(f32 delta);
+    void draw() {}
+
+    REGISTER_NO_FIELDS(BENCHMARK, BenchmarkEntity);
+};
+
+void BenchmarkEntity::update(f32 delta) {
+    updates++;
+    // The parent might have been removed, or be removed right now.
+    Entity *other = fetch_entity(parent);
+    if (other && other->type() != EntityType::BENCHMARK)
+        benchmark_bad_lookups++;
+
+    u32 hash = (id.slot * 2654435761u) ^ (updates * 40503u);
+    if (hash % 3 == 0) {
+        BenchmarkEntity entity = {};
+        entity.born = benchmark_frame + 1;
+        entity.parent = id;
+        entity.child = invalid_id();
+        child = add_entity(entity);
+        benchmark_adds++;
+    }
+    if ((hash >> 8) % 3 == 0) {
+        remove_entity(id);
+        benchmark_removes++;
+    }
+}
+
+// Checks that the entities that are left are the ones that should be,
+// that they're all reachable from their ids, and updated once a frame.
+static bool check_benchmark_entities(u32 expected) {
+    EntityPool *pool = _fog_es.pools + (u32) EntityType::BENCHMARK;
+    bool passed = _fog_es.num_entities == expected && pool->num_alive == expected;
+    if (!passed)
+        ERR("Expected %u entities, there are %u (%u in the pool)", expected,
+            _fog_es.num_entities, pool->num_alive);
+
+    u32 linked = 0;
+    for (u32 i = 0; i < pool->length; i++) {
+        BenchmarkEntity *e = (BenchmarkEntity *) pool->get(i);
+        if (!is_linked(e)) continue;
+        linked++;
+        if (fetch_entity(e->id) != e) {
+            ERR("Entity %d can't be found from its id", e->id.slot);
+            passed = false;
+        }
+        if (e->updates != benchmark_frame - e->born + 1) {
+            ERR("Entity %d was updated %u times in %u frames", e->id.slot,
+                e->updates, benchmark_frame - e->born + 1);
+            passed = false;
+        }
+        BenchmarkEntity *child = (BenchmarkEntity *) fetch_entity(e->child);
+        if (child && !(child->parent == e->id)) {
+            ERR("Entity %d has the wrong child", e->id.slot);
+            passed = false;
+        }
+    }
+    if (linked != expected) {
+        ERR("Expected %u entities in the pool, found %u", expected, linked);
+        passed = false;
+    }
+    return passed;
+}
+
+bool run_benchmark() {
+    REGISTER_ENTITY(BenchmarkEntity);
+    benchmark_frame = 0;
+    for (u32 i = 0; i < BENCHMARK_ENTITIES; i++) {
+        BenchmarkEntity entity = {};
+        entity.parent = invalid_id();
+        entity.child = invalid_id();
+        add_entity(entity);
+    }
+
+    u32 expected = BENCHMARK_ENTITIES;
+    f64 total_time = 0.0;
+    f64 best_time = 0.0;
+    bool passed = true;
+    for (; benchmark_frame < BENCHMARK_FRAMES; benchmark_frame++) {
+        benchmark_adds = 0;
+        benchmark_removes = 0;
+        Util::swap_frame_memory();
+        u64 start = Perf::highp_now();
+        update_es();
+        f64 time = (Perf::highp_now() - start) / 1000.0;
+        total_time += time;
+        best_time = benchmark_frame == 0 ? time : MIN(best_time, time);
+
+        expected += benchmark_adds - benchmark_removes;
+        passed &= check_benchmark_entities(expected);
+        defragment_entity_memory();
+    }
+    if (benchmark_bad_lookups) {
+        ERR("%u lookups found the wrong entity", (u32) benchmark_bad_lookups);
+        passed = false;
+    }
+    printf("Updated %u frames on %u workers, %u entities left:\n", BENCHMARK_FRAMES,
+           Util::num_workers(), expected);
+    printf("  %7.3f ms avg, %7.3f ms best\n", total_time / BENCHMARK_FRAMES, best_time);
+    return passed;
+}
+
+}  // namespace Logic
@@ -37,7 +37,9 @@ template <class T, class M> M _fog_member_type(M T:: *);
                 sizeof(self),                                                 \
                 LEN(_fog_fields),                                             \
                 _fog_fields_mem,                                              \
-                true};                                                        \
+                true,                                                         \
+                self::parallel_update,                                        \
+                self::track_changes};                                         \
     }
 
 #define REGISTER_NO_FIELDS(EnumType, SelfType)                     \
@@ -54,7 +56,9 @@ template <class T, class M> M _fog_member_type(M T:: *);
                 sizeof(SelfType),                                  \
                 0,                                                 \
                 nullptr,                                           \
-                true};                                             \
+                true,                                              \
+                SelfType::parallel_update,                         \
+                SelfType::track_changes};                          \
     }
 
 #define REGISTER_ENTITY(T)                                                 \
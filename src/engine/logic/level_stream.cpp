@@ -0,0 +1,307 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+namespace Logic {
+
+enum ChunkState : u32 {
+    CHUNK_UNLOADED,
+    CHUNK_LOADING, // Being read on a worker.
+    CHUNK_READ,    // Read, but not added to the ES.
+    CHUNK_LOADED,
+};
+
+struct StreamChunk {
+    ChunkHeader header;
+    std::atomic<u32> state;
+    u8 *data;
+    Util::List<EntityID> entities;
+};
+
+struct LevelStream {
+    int fd;
+    u32 num_chunks;
+    StreamChunk *chunks;
+
+    // Chunks closer than this to a camera are loaded, and chunks
+    // further away than "unload_distance" are unloaded.
+    f32 load_distance;
+    f32 unload_distance;
+
+    // Bytes of entities that are loaded, or are being loaded.
+    u64 memory_budget;
+    u64 memory_used;
+
+    // Number of chunks that are added to the ES each frame.
+    u32 max_chunks_per_frame;
+} _fog_level_stream = {-1};
+
+static u64 hash_bytes(u64 hash, const void *data, u64 size) {
+    // FNV-1a
+    for (u64 i = 0; i < size; i++)
+        hash = (hash ^ ((const u8 *) data)[i]) * 0x100000001B3;
+    return hash;
+}
+
+static u64 hash_string(u64 hash, const char *str) {
+    return hash_bytes(hash, str, Util::str_len(str));
+}
+
+// The type names are used since the type hashes differ between compilers.
+u64 layout_signature(EntityType type) {
+    EMeta meta = meta_data_for(type);
+    u64 hash = 0xCBF29CE484222325;
+    hash = hash_string(hash, fetch_type(meta.hash)->name);
+    hash = hash_bytes(hash, &meta.size, sizeof(meta.size));
+    for (u32 i = 0; i < meta.num_fields; i++) {
+        auto *field = meta.fields + i;
+        auto *info = fetch_type(field->hash);
+        hash = hash_string(hash, field->name);
+        hash = hash_string(hash, info->name);
+        hash = hash_bytes(hash, &field->offset, sizeof(field->offset));
+        hash = hash_bytes(hash, &info->size, sizeof(info->size));
+    }
+    return hash;
+}
+
+bool matches_layout(const CompiledTypeBlock *block) {
+    if ((u32) block->type >= _NUM_ENTITY_TYPES) return false;
+    if (!_fog_global_entity_list[(u32) block->type].registered) return false;
+    if (block->stride != meta_data_for(block->type).size) return false;
+    if (block->signature != layout_signature(block->type)) {
+        LOG("The layout of %s has changed, the compiled level is out of date",
+            fetch_entity_type(block->type)->name);
+        return false;
+    }
+    return true;
+}
+
+bool open_level_stream(const char *filename) {
+    if (_fog_level_stream.fd >= 0) close_level_stream();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    StreamedLevelHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (s64) sizeof(header) ||
+        header.magic != STREAMED_LEVEL_MAGIC ||
+        header.version != STREAMED_LEVEL_VERSION) {
+        close(fd);
+        return false;
+    }
+
+    // Everything in the header comes from the file, so the table and
+    // the chunks are checked to be inside of it before they're read.
+    struct stat info;
+    u64 table_size = sizeof(ChunkHeader) * (u64) header.num_chunks;
+    if (fstat(fd, &info) != 0 ||
+        (u64) info.st_size < sizeof(header) + table_size) {
+        ERR("The chunk table of \"%s\" doesn't fit in the file", filename);
+        close(fd);
+        return false;
+    }
+    u64 file_size = info.st_size;
+    ChunkHeader *table = Util::request_temporary_memory<ChunkHeader>(header.num_chunks);
+    if (pread(fd, table, table_size, sizeof(header)) != (s64) table_size) {
+        close(fd);
+        return false;
+    }
+    for (u32 i = 0; i < header.num_chunks; i++) {
+        if (table[i].offset > file_size || table[i].size > file_size - table[i].offset) {
+            ERR("Chunk %u of \"%s\" is outside of the file", i, filename);
+            close(fd);
+            return false;
+        }
+    }
+
+    LevelStream *stream = &_fog_level_stream;
+    stream->fd = fd;
+    stream->num_chunks = header.num_chunks;
+    Util::allow_allocation();
+    stream->chunks = Util::push_memory<StreamChunk>(header.num_chunks);
+    for (u32 i = 0; i < header.num_chunks; i++) {
+        StreamChunk *chunk = stream->chunks + i;
+        chunk->header = table[i];
+        chunk->state = CHUNK_UNLOADED;
+        chunk->data = nullptr;
+        chunk->entities = {};
+    }
+    if (!stream->load_distance) {
+        stream->load_distance = header.chunk_size * 2.0;
+        stream->unload_distance = header.chunk_size * 3.0;
+        stream->memory_budget = 1 << 26;
+        stream->max_chunks_per_frame = 4;
+    }
+    stream->memory_used = 0;
+    return true;
+}
+
+static void unload_chunk(StreamChunk *chunk) {
+    for (u32 i = 0; i < chunk->entities.length; i++)
+        remove_entity(chunk->entities[i]);
+    chunk->entities.clear();
+    _fog_level_stream.memory_used -= chunk->header.size;
+    chunk->state = CHUNK_UNLOADED;
+}
+
+void close_level_stream() {
+    LevelStream *stream = &_fog_level_stream;
+    if (stream->fd < 0) return;
+    for (u32 i = 0; i < stream->num_chunks; i++) {
+        StreamChunk *chunk = stream->chunks + i;
+        // Wait for the worker to finish reading it.
+        while (chunk->state == CHUNK_LOADING)
+            std::this_thread::yield();
+        if (chunk->state == CHUNK_READ) {
+            Util::pop_memory(chunk->data);
+            stream->memory_used -= chunk->header.size;
+            chunk->state = CHUNK_UNLOADED;
+        }
+        if (chunk->state == CHUNK_LOADED)
+            unload_chunk(chunk);
+        if (chunk->entities.initalized)
+            Util::pop_memory(chunk->entities.data);
+    }
+    Util::pop_memory(stream->chunks);
+    stream->chunks = nullptr;
+    stream->num_chunks = 0;
+    close(stream->fd);
+    stream->fd = -1;
+}
+
+// Adds the entities that were read on the worker to the ES. The blocks
+// come from the file, so they're checked against what's left of the
+// chunk before anything is copied.
+static void add_chunk_entities(StreamChunk *chunk) {
+    if (!chunk->entities.initalized) {
+        Util::allow_allocation();
+        chunk->entities = Util::create_list<EntityID>(chunk->header.num_entities);
+    }
+
+    u8 *data = chunk->data;
+    u64 left = chunk->header.size;
+    for (u32 b = 0; b < chunk->header.num_blocks; b++) {
+        if (left < sizeof(CompiledTypeBlock)) {
+            ERR("A level chunk ends in the middle of a block");
+            break;
+        }
+        CompiledTypeBlock *block = (CompiledTypeBlock *) data;
+        u8 *records = data + sizeof(CompiledTypeBlock);
+        left -= sizeof(CompiledTypeBlock);
+        if (!matches_layout(block)) {
+            ERR("Skipping a chunk that doesn't match the entities");
+            break;
+        }
+        u64 size = (u64) block->count * block->stride;
+        if (size > left) {
+            ERR("A level chunk has more entities than it has room for");
+            break;
+        }
+        Util::copy_bytes(records, reserve_entities(block->type, block->count), size);
+        add_entities_bulk(block->type, block->count);
+
+        EntityPool *pool = _fog_es.pools + (u32) block->type;
+        for (u32 i = pool->length - block->count; i < pool->length; i++) {
+            Util::allow_allocation();
+            chunk->entities.append(pool->get(i)->id);
+        }
+        data = records + size;
+        left -= size;
+    }
+    Util::pop_memory(chunk->data);
+    chunk->data = nullptr;
+    chunk->state = CHUNK_LOADED;
+}
+
+static void read_chunk(int fd, StreamChunk *chunk) {
+    Util::allow_allocation();
+    u8 *data = Util::push_memory<u8>(chunk->header.size);
+    u64 read = pread(fd, data, chunk->header.size, chunk->header.offset);
+    if (read != chunk->header.size) {
+        ERR("Failed to read level chunk");
+        chunk->header.num_blocks = 0;
+    }
+    chunk->data = data;
+    chunk->state = CHUNK_READ;
+}
+
+// The distance from the closest active camera to the chunk.
+static f32 chunk_distance(StreamChunk *chunk) {
+    f32 closest = -1;
+    for (u32 i = 0; i < OPENGL_NUM_CAMERAS; i++) {
+        if (i && !(Renderer::_fog_active_cameras & (1 << i))) continue;
+        // The camera position is the negated center of the view.
+        Vec2 p = -Renderer::get_camera(i)->position;
+        Vec2 min = chunk->header.min;
+        Vec2 max = chunk->header.max;
+        Vec2 d = V2(MAX(MAX(min.x - p.x, p.x - max.x), 0.0),
+                    MAX(MAX(min.y - p.y, p.y - max.y), 0.0));
+        f32 distance = length(d);
+        if (closest < 0 || distance < closest)
+            closest = distance;
+    }
+    return closest;
+}
+
+void update_level_stream() {
+    LevelStream *stream = &_fog_level_stream;
+    if (stream->fd < 0) return;
+    ASSERT(!_fog_es.deferring,
+           "Cannot stream the level while iterating over entities");
+
+    f32 *distances = Util::request_temporary_memory<f32>(stream->num_chunks);
+    u32 *wanted = Util::request_temporary_memory<u32>(stream->num_chunks);
+    u32 num_wanted = 0;
+    u32 added = 0;
+    for (u32 i = 0; i < stream->num_chunks; i++) {
+        StreamChunk *chunk = stream->chunks + i;
+        distances[i] = chunk_distance(chunk);
+        switch (chunk->state) {
+        case CHUNK_UNLOADED:
+            if (distances[i] <= stream->load_distance)
+                wanted[num_wanted++] = i;
+            break;
+        case CHUNK_READ:
+            if (added < stream->max_chunks_per_frame) {
+                add_chunk_entities(chunk);
+                added++;
+            }
+            break;
+        case CHUNK_LOADED:
+            if (distances[i] > stream->unload_distance)
+                unload_chunk(chunk);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // The closest chunks are loaded first, if there isn't room for a chunk
+    // the chunks furthest away are unloaded, if they are further away.
+    std::sort(wanted, wanted + num_wanted, [distances](u32 a, u32 b) {
+        return distances[a] < distances[b];
+    });
+    for (u32 w = 0; w < num_wanted; w++) {
+        StreamChunk *chunk = stream->chunks + wanted[w];
+        while (stream->memory_used + chunk->header.size > stream->memory_budget) {
+            s32 furthest = -1;
+            for (u32 i = 0; i < stream->num_chunks; i++) {
+                if (stream->chunks[i].state != CHUNK_LOADED) continue;
+                if (furthest < 0 || distances[furthest] < distances[i])
+                    furthest = i;
+            }
+            if (furthest < 0 || distances[furthest] <= distances[wanted[w]])
+                break;
+            unload_chunk(stream->chunks + furthest);
+        }
+        if (stream->memory_used + chunk->header.size > stream->memory_budget)
+            break;
+
+        stream->memory_used += chunk->header.size;
+        chunk->state = CHUNK_LOADING;
+        int fd = stream->fd;
+        Util::schedule_job([fd, chunk]() { read_chunk(fd, chunk); });
+    }
+}
+
+}  // namespace Logic
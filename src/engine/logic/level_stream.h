@@ -0,0 +1,67 @@
+namespace Logic {
+
+///# Level streaming
+// Large levels can be split up into spatial chunks that are loaded
+// when they come close to an active camera, and unloaded when they
+// are far away. The chunks are read on a worker thread and added to
+// the ES at the start of the next frame, the engine does this every
+// frame before the update, a game only has to open the level.
+//
+// Streamed chunks are treated as static content, changes made to the
+// entities in a chunk are lost when it's unloaded.
+
+// The entities of one type, as they're written in compiled and
+// streamed levels. It's followed by "count" records of "stride"
+// bytes, which is the raw memory of the entities.
+struct CompiledTypeBlock {
+    EntityType type;
+    u32 count;
+    u64 stride;
+    u64 signature;
+};
+
+constexpr u32 STREAMED_LEVEL_MAGIC = 0x4843464F; // "OFCH"
+constexpr u32 STREAMED_LEVEL_VERSION = 1;
+
+struct StreamedLevelHeader {
+    u32 magic;
+    u32 version;
+    u32 num_chunks;
+    f32 chunk_size;
+};
+
+// Each chunk is a list of "CompiledTypeBlock"s followed by
+// their records, starting at "offset" in the file.
+struct ChunkHeader {
+    Vec2 min;
+    Vec2 max;
+    u64 offset;
+    u64 size;
+    u32 num_blocks;
+    u32 num_entities;
+};
+
+///*
+// Changes if anything that is saved about the entity changes, so
+// records written with another layout can be detected.
+u64 layout_signature(EntityType type);
+
+///*
+// Checks that the block was written with entities that look like
+// the ones in the game.
+bool matches_layout(const CompiledTypeBlock *block);
+
+///*
+// Opens a streamed level, nothing is loaded until the next frame.
+// Returns false if the file isn't a streamed level.
+bool open_level_stream(const char *filename);
+
+///*
+// Removes all entities that were streamed in, and closes the level.
+void close_level_stream();
+
+// Loads and unloads chunks depending on where the active cameras
+// are. Called once per frame, outside of the entity update.
+void update_level_stream();
+
+}  // namespace Logic
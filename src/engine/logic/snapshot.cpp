@@ -0,0 +1,318 @@
+namespace Logic {
+
+struct SnapshotPool {
+    u32 length;
+    u32 num_alive;
+    u32 num_free;
+    u32 compact_cursor;
+    bool compacting;
+};
+
+// The start of the flat buffer, it's followed by the generations, the
+// free slots, and the memory and free list of each pool.
+struct SnapshotHeader {
+    s32 max_entity;
+    s32 num_slots;
+    u32 num_entities;
+    u32 num_free_slots;
+    u32 num_shapes;
+    XORWOWState random;
+    SnapshotPool pools[_NUM_ENTITY_TYPES];
+};
+
+// The callbacks of the timers can't be copied as bytes, so only the
+// times and the lists are stored.
+struct SnapshotTimer {
+    s16 forward;
+    u8 gen;
+    f32 start;
+    f32 next;
+    f32 end;
+    f32 spacing;
+};
+
+struct SnapshotBucket {
+    s16 active;
+    s16 free;
+    SnapshotTimer timers[TimerBucket::NUM_TIMERS];
+};
+
+static void snapshot_reserve(Snapshot *snapshot, u64 size) {
+    if (size <= snapshot->capacity) return;
+    u64 capacity = MAX(snapshot->capacity * 2, size);
+    Util::allow_allocation();
+    snapshot->data = Util::resize_memory<u8>(snapshot->data, capacity);
+    ASSERT(snapshot->data, "Failed to grow snapshot");
+    snapshot->capacity = capacity;
+}
+
+static void snapshot_write(Snapshot *snapshot, const void *data, u64 size) {
+    Util::copy_bytes((void *) data, snapshot->data + snapshot->size, size);
+    snapshot->size += size;
+}
+
+static const u8 *snapshot_read(const u8 *from, void *to, u64 size) {
+    Util::copy_bytes((void *) from, to, size);
+    return from + size;
+}
+
+Snapshot *create_snapshot(u64 capacity) {
+    Util::allow_allocation();
+    Snapshot *snapshot = Util::push_memory<Snapshot>();
+    *snapshot = {};
+    snapshot_reserve(snapshot, capacity);
+    return snapshot;
+}
+
+void destroy_snapshot(Snapshot *snapshot) {
+    Util::pop_memory(snapshot->data);
+    Util::pop_memory(snapshot);
+}
+
+void take_snapshot(Snapshot *snapshot) {
+    ASSERT(!_fog_es.deferring, "Cannot snapshot while iterating over entities");
+    SnapshotHeader header = {};
+    header.max_entity = _fog_es.max_entity;
+    header.num_slots = _fog_es.num_slots;
+    header.num_entities = _fog_es.num_entities;
+    header.num_free_slots = _fog_es.free_slots.length;
+    header.num_shapes = Physics::global_shape_list.length;
+    header.random = random_state;
+
+    u64 size = sizeof(header) + sizeof(SnapshotBucket) * At::COUNT;
+    size += header.num_slots * sizeof(u32);
+    size += header.num_free_slots * sizeof(s32);
+    for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+        EntityPool *pool = _fog_es.pools + type;
+        header.pools[type] = {pool->length, pool->num_alive, pool->free.length,
+                              pool->compact_cursor, pool->compacting};
+        size += pool->length * pool->stride + pool->free.length * sizeof(u32);
+    }
+    snapshot_reserve(snapshot, size);
+
+    snapshot->size = 0;
+    snapshot_write(snapshot, &header, sizeof(header));
+    // Right after the header, so they stay in the same blocks.
+    for (u32 i = 0; i < At::COUNT; i++) {
+        TimerBucket *from = logic_system.buckets + i;
+        // The padding is cleared, the deltas compare the bytes.
+        SnapshotBucket bucket;
+        memset(&bucket, 0, sizeof(bucket));
+        bucket.active = from->active;
+        bucket.free = from->free;
+        for (u32 j = 0; j < TimerBucket::NUM_TIMERS; j++) {
+            Timer *timer = from->timers + j;
+            SnapshotTimer *to = bucket.timers + j;
+            to->forward = timer->forward;
+            to->gen = timer->gen;
+            to->start = timer->start;
+            to->next = timer->next;
+            to->end = timer->end;
+            to->spacing = timer->spacing;
+        }
+        snapshot_write(snapshot, &bucket, sizeof(bucket));
+    }
+    snapshot_write(snapshot, _fog_es.generations.data, header.num_slots * sizeof(u32));
+    snapshot_write(snapshot, _fog_es.free_slots.data, header.num_free_slots * sizeof(s32));
+    for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+        EntityPool *pool = _fog_es.pools + type;
+        if (!pool->length) continue;
+        snapshot_write(snapshot, pool->memory, pool->length * pool->stride);
+        snapshot_write(snapshot, pool->free.data, pool->free.length * sizeof(u32));
+    }
+}
+
+template <typename T>
+static void reserve_list(Util::List<T> *list, u32 length) {
+    if (list->capacity > length) return;
+    Util::allow_allocation();
+    list->resize(length + 1);
+}
+
+void restore_snapshot(Snapshot *snapshot) {
+    ASSERT(!_fog_es.deferring, "Cannot restore while iterating over entities");
+    ASSERT(snapshot->size, "Restoring an empty snapshot");
+    SnapshotHeader header;
+    const u8 *data = snapshot_read(snapshot->data, &header, sizeof(header));
+    for (u32 i = 0; i < At::COUNT; i++) {
+        TimerBucket *to = logic_system.buckets + i;
+        SnapshotBucket bucket;
+        data = snapshot_read(data, &bucket, sizeof(bucket));
+        to->active = bucket.active;
+        to->free = bucket.free;
+        for (u32 j = 0; j < TimerBucket::NUM_TIMERS; j++) {
+            SnapshotTimer *from = bucket.timers + j;
+            Timer *timer = to->timers + j;
+            timer->forward = from->forward;
+            timer->start = from->start;
+            timer->next = from->next;
+            timer->end = from->end;
+            timer->spacing = from->spacing;
+            // The slot has been given to another callback since the
+            // snapshot, the old one is gone so it's removed instead.
+            if (timer->gen != from->gen) {
+                timer->next = -1.0;
+                timer->end = -1.0;
+            }
+        }
+    }
+
+    _fog_es.max_entity = header.max_entity;
+    _fog_es.num_slots = header.num_slots;
+    _fog_es.num_entities = header.num_entities;
+    if ((s32) _fog_es.entities.capacity < header.num_slots)
+        grow_slot_table(header.num_slots);
+    // New ids index the generations with any slot in the table.
+    reserve_list(&_fog_es.generations, _fog_es.entities.capacity);
+    reserve_list(&_fog_es.free_slots, header.num_free_slots);
+    data = snapshot_read(data, _fog_es.generations.data, header.num_slots * sizeof(u32));
+    data = snapshot_read(data, _fog_es.free_slots.data, header.num_free_slots * sizeof(s32));
+    _fog_es.free_slots.length = header.num_free_slots;
+
+    // The pools might have moved since the snapshot was taken,
+    // so the slot table is built again.
+    for (u32 i = 0; i < _fog_es.entities.capacity; i++)
+        _fog_es.entities[i] = nullptr;
+    for (u32 type = 0; type < _NUM_ENTITY_TYPES; type++) {
+        SnapshotPool *from = header.pools + type;
+        EntityPool *pool = _fog_es.pools + type;
+        if (from->length) {
+            pool = pool_for((EntityType) type);
+            // Nothing is linked to the pool at this point.
+            pool->length = 0;
+            while (pool->capacity < from->length)
+                grow_pool(pool);
+            reserve_list(&pool->free, from->num_free);
+            data = snapshot_read(data, pool->memory, from->length * pool->stride);
+            data = snapshot_read(data, pool->free.data, from->num_free * sizeof(u32));
+        }
+        if (pool->free.initalized)
+            pool->free.length = from->num_free;
+        pool->length = from->length;
+        pool->num_alive = from->num_alive;
+        pool->compact_cursor = from->compact_cursor;
+        pool->compacting = from->compacting;
+
+        for (u32 i = 0; i < pool->length; i++) {
+            Entity *e = pool->get(i);
+            pool->dirty[i] = ALL_FIELDS;
+            if (e->id.slot < 0) continue;
+            _fog_es.entities[e->id.slot] = e;
+        }
+    }
+
+    // Shapes can't be changed once they're added, so only the
+    // ones that were added after the snapshot are removed.
+    ASSERT(header.num_shapes <= Physics::global_shape_list.length,
+           "Shapes have been removed since the snapshot was taken");
+    while (Physics::global_shape_list.length > header.num_shapes) {
+        Physics::Shape shape = Physics::global_shape_list.pop();
+        Util::destroy_list(&shape.points);
+        Util::destroy_list(&shape.normals);
+    }
+
+    random_state = header.random;
+}
+
+SnapshotHistory *create_snapshot_history(u32 length, u64 capacity) {
+    ASSERT(length, "A history has to hold at least one snapshot");
+    Util::allow_allocation();
+    SnapshotHistory *history = Util::push_memory<SnapshotHistory>();
+    *history = {};
+    snapshot_reserve(&history->latest, capacity);
+    snapshot_reserve(&history->scratch, capacity);
+    history->max_deltas = length - 1;
+    Util::allow_allocation();
+    history->deltas = Util::push_memory<SnapshotDelta>(history->max_deltas + 1);
+    for (u32 i = 0; i <= history->max_deltas; i++)
+        history->deltas[i] = {};
+    return history;
+}
+
+void destroy_snapshot_history(SnapshotHistory *history) {
+    Util::pop_memory(history->latest.data);
+    Util::pop_memory(history->scratch.data);
+    for (u32 i = 0; i <= history->max_deltas; i++) {
+        Util::pop_memory(history->deltas[i].indices);
+        Util::pop_memory(history->deltas[i].blocks);
+    }
+    Util::pop_memory(history->deltas);
+    Util::pop_memory(history);
+}
+
+// Stores the blocks of "older" that differ from "newer".
+static void encode_delta(SnapshotDelta *delta, Snapshot *older, Snapshot *newer) {
+    constexpr u64 BLOCK_SIZE = SnapshotHistory::BLOCK_SIZE;
+    u32 num_blocks = (older->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (delta->block_capacity < num_blocks) {
+        Util::allow_allocation();
+        delta->indices = Util::resize_memory<u32>(delta->indices, num_blocks);
+        Util::allow_allocation();
+        delta->blocks = Util::resize_memory<u8>(delta->blocks, num_blocks * BLOCK_SIZE);
+        delta->block_capacity = num_blocks;
+    }
+
+    delta->size = older->size;
+    delta->num_blocks = 0;
+    for (u32 i = 0; i < num_blocks; i++) {
+        u64 offset = i * BLOCK_SIZE;
+        u64 size = MIN(BLOCK_SIZE, older->size - offset);
+        if (offset + size <= newer->size &&
+            !memcmp(older->data + offset, newer->data + offset, size))
+            continue;
+        delta->indices[delta->num_blocks] = i;
+        Util::copy_bytes(older->data + offset,
+                         delta->blocks + delta->num_blocks * BLOCK_SIZE, size);
+        delta->num_blocks++;
+    }
+}
+
+// Turns "snapshot" into the one the delta was made from.
+static void apply_delta(SnapshotDelta *delta, Snapshot *snapshot) {
+    constexpr u64 BLOCK_SIZE = SnapshotHistory::BLOCK_SIZE;
+    snapshot_reserve(snapshot, delta->size);
+    for (u32 i = 0; i < delta->num_blocks; i++) {
+        u64 offset = delta->indices[i] * BLOCK_SIZE;
+        u64 size = MIN(BLOCK_SIZE, delta->size - offset);
+        Util::copy_bytes(delta->blocks + i * BLOCK_SIZE, snapshot->data + offset, size);
+    }
+    snapshot->size = delta->size;
+}
+
+static void swap_snapshots(Snapshot *a, Snapshot *b) {
+    std::swap(a->data, b->data);
+    std::swap(a->size, b->size);
+    std::swap(a->capacity, b->capacity);
+}
+
+void push_snapshot(SnapshotHistory *history) {
+    take_snapshot(&history->scratch);
+    if (history->has_latest && history->max_deltas) {
+        history->head = (history->head + 1) % history->max_deltas;
+        encode_delta(history->deltas + history->head,
+                     &history->latest, &history->scratch);
+        history->num_deltas = MIN(history->num_deltas + 1, history->max_deltas);
+    }
+    swap_snapshots(&history->latest, &history->scratch);
+    history->has_latest = true;
+}
+
+bool rewind_snapshot(SnapshotHistory *history, u32 steps) {
+    if (!history->has_latest || steps > history->num_deltas) return false;
+    if (steps) {
+        Snapshot *scratch = &history->scratch;
+        snapshot_reserve(scratch, history->latest.size);
+        Util::copy_bytes(history->latest.data, scratch->data, history->latest.size);
+        scratch->size = history->latest.size;
+        for (u32 i = 0; i < steps; i++) {
+            apply_delta(history->deltas + history->head, scratch);
+            history->head = (history->head + history->max_deltas - 1) % history->max_deltas;
+        }
+        history->num_deltas -= steps;
+        swap_snapshots(&history->latest, scratch);
+    }
+    restore_snapshot(&history->latest);
+    return true;
+}
+
+}
@@ -0,0 +1,95 @@
+namespace Logic {
+
+///# Snapshots
+// A snapshot is a copy of the simulation state, which can be restored
+// later. This is used for rollback, resetting a level instantly or
+// setting up a test. A snapshot contains:
+// <ul>
+//   <li>All entities, and the tables of the ES.</li>
+//   <li>The list of physics shapes.</li>
+//   <li>The logic timers.</li>
+//   <li>The state of the random number generator.</li>
+// </ul>
+// Particles, sounds and the camera are not part of the snapshot, and
+// neither is the clock, so timers are restored with their absolute times.
+//
+// Everything is written into one flat buffer, so a restore is mostly a
+// memcpy. The callbacks of the timers can't be copied as bytes, so only
+// their times are stored and the callbacks are left where they are. A
+// timer whose slot has been given to a new callback since the snapshot
+// was taken can't be brought back, it's removed when restored.
+
+struct Snapshot {
+    u8 *data;
+    u64 size;
+    u64 capacity;
+};
+
+// A snapshot stored as the blocks that differ from the snapshot
+// after it.
+struct SnapshotDelta {
+    u64 size;
+    u32 num_blocks;
+    u32 block_capacity;
+    u32 *indices;
+    u8 *blocks;
+};
+
+///* SnapshotHistory
+// A number of consecutive snapshots, where only the newest is
+// stored whole and the older ones are stored as the blocks that
+// changed. Used for rollback.
+struct SnapshotHistory {
+    static constexpr u64 BLOCK_SIZE = 1 << 12;
+
+    Snapshot latest;
+    Snapshot scratch;
+    bool has_latest;
+
+    // A ring of the older snapshots, "head" is the newest.
+    SnapshotDelta *deltas;
+    u32 num_deltas;
+    u32 max_deltas;
+    u32 head;
+};
+
+///*
+// Creates a snapshot with room for "capacity" bytes, it grows if
+// it's too small but that requires an allocation.
+Snapshot *create_snapshot(u64 capacity=1 << 20);
+
+///*
+// Frees the snapshot.
+void destroy_snapshot(Snapshot *snapshot);
+
+///*
+// Copies the current state into the snapshot, this
+// cannot be called while the entities are updated or drawn.
+void take_snapshot(Snapshot *snapshot);
+
+///*
+// Sets the current state to what's in the snapshot, this
+// cannot be called while the entities are updated or drawn.
+// All restored entities are marked as changed.
+void restore_snapshot(Snapshot *snapshot);
+
+///*
+// Creates a history that can go back "length" snapshots.
+SnapshotHistory *create_snapshot_history(u32 length, u64 capacity=1 << 20);
+
+///*
+// Frees the history and all snapshots in it.
+void destroy_snapshot_history(SnapshotHistory *history);
+
+///*
+// Takes a snapshot and adds it to the history, the oldest
+// snapshot is forgotten if the history is full.
+void push_snapshot(SnapshotHistory *history);
+
+///*
+// Restores the snapshot "steps" snapshots back, 0 is the
+// newest. All snapshots newer than it are removed from the
+// history. Returns false if the history isn't that long.
+bool rewind_snapshot(SnapshotHistory *history, u32 steps=0);
+
+}
@@ -0,0 +1,225 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Mixer {
+
+void Ramp::set(f32 target, f32 blocks) {
+    this->target = target;
+    if (blocks < 1.0) {
+        value = target;
+        delta = 0.0;
+    } else {
+        delta = (target - value) / blocks;
+    }
+}
+
+void Ramp::step() {
+    if (delta > 0 && value < target) {
+        value = MIN(value + delta, target);
+    } else if (delta < 0 && value > target) {
+        value = MAX(value + delta, target);
+    }
+}
+
+void add_samples(f32 *to, const f32 *from, f32 scale, u32 count) {
+    u32 i = 0;
+#ifdef __SSE2__
+    __m128 s = _mm_set1_ps(scale);
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(to + i), _mm_mul_ps(_mm_loadu_ps(from + i), s));
+        _mm_storeu_ps(to + i, sum);
+    }
+#endif
+    for (; i < count; i++)
+        to[i] += from[i] * scale;
+}
+
+void clamp_samples(f32 *samples, f32 limit, u32 count) {
+    u32 i = 0;
+#ifdef __SSE2__
+    __m128 high = _mm_set1_ps(limit);
+    __m128 low = _mm_set1_ps(-limit);
+    for (; i + 4 <= count; i += 4) {
+        __m128 clamped = _mm_max_ps(low, _mm_min_ps(high, _mm_loadu_ps(samples + i)));
+        _mm_storeu_ps(samples + i, clamped);
+    }
+#endif
+    for (; i < count; i++)
+        samples[i] = CLAMP(-limit, limit, samples[i]);
+}
+
+void Delay::init(f32 *buffer, u32 capacity, f32 sample_rate) {
+    ASSERT(capacity % 2 == 0, "The delay holds whole frames");
+    this->buffer = buffer;
+    this->capacity = capacity;
+    this->sample_rate = sample_rate;
+    reset();
+}
+
+void Delay::set(f32 feedback, f32 seconds, f32 blocks) {
+    if (!active())
+        stale = true;
+    this->feedback.set(feedback, blocks);
+    this->seconds.set(seconds, blocks);
+}
+
+bool Delay::active() const {
+    return seconds.value > 0 || seconds.target > 0 || feedback.value > 0 || feedback.target > 0;
+}
+
+void Delay::process(f32 *samples, u32 frames) {
+    if (stale) {
+        for (u32 i = 0; i < capacity; i++)
+            buffer[i] = 0.0;
+        stale = false;
+    }
+    feedback.step();
+    seconds.step();
+    //TODO(GS) crackling when length is changed while sound is playing
+    u32 length = (u32) (seconds.value * sample_rate) * 2;
+    length = CLAMP(2u, capacity, length);
+
+    // Done in spans that don't wrap around the buffer and are
+    // shorter than the echo, so each span only reads sound that
+    // was written before it.
+    u32 count = frames * 2;
+    for (u32 done = 0; done < count;) {
+        u32 tail = (head + capacity - length) % capacity;
+        u32 span = MIN(count - done, length);
+        span = MIN(span, capacity - head);
+        span = MIN(span, capacity - tail);
+        add_samples(samples + done, buffer + tail, feedback.value, span);
+        Util::copy_bytes(samples + done, buffer + head, span * sizeof(f32));
+        head = (head + span) % capacity;
+        done += span;
+    }
+}
+
+void Delay::reset() {
+    head = 0;
+    stale = true;
+    feedback = {};
+    seconds = {};
+}
+
+// The cutoff frequency the old one pole filters had for "weight",
+// so the weights sound about the same as they used to.
+static f32 cutoff_for(Biquad::Kind kind, f32 weight, f32 sample_rate) {
+    const f32 SENSITIVITY = 0.03;
+    f32 coefficient = weight * (1 + SENSITIVITY) - SENSITIVITY;
+    f32 max_cutoff = 0.45 * sample_rate;
+    f32 cutoff;
+    if (kind == Biquad::LOWPASS)
+        cutoff = coefficient >= 1 ? max_cutoff : -log(1 - MAX(coefficient, 0.0f));
+    else
+        cutoff = coefficient <= 0 ? max_cutoff : -log(MIN(coefficient, 1.0f));
+    cutoff *= sample_rate / (2 * M_PI);
+    return CLAMP(10.0f, max_cutoff, cutoff);
+}
+
+void Biquad::init(Kind kind, f32 sample_rate) {
+    this->kind = kind;
+    this->sample_rate = sample_rate;
+    reset();
+}
+
+void Biquad::set(f32 weight, f32 blocks) {
+    ASSERT(0 <= weight && weight <= 1, "Weight needs to be between 0 and 1.");
+    if (!active()) {
+        z1[0] = z1[1] = 0.0;
+        z2[0] = z2[1] = 0.0;
+    }
+    this->weight.set(weight, blocks);
+}
+
+bool Biquad::active() const {
+    return weight.value < 1 || weight.target < 1;
+}
+
+void Biquad::process(f32 *samples, u32 frames) {
+    weight.step();
+    if (weight.value != coefficients_for) {
+        // A Butterworth filter, from the Audio EQ Cookbook.
+        f32 omega = 2 * M_PI * cutoff_for(kind, weight.value, sample_rate) / sample_rate;
+        f32 cos_omega = cos(omega);
+        f32 alpha = sin(omega) / (2 * 0.7071);
+        f32 a0 = 1 + alpha;
+        if (kind == LOWPASS) {
+            b0 = (1 - cos_omega) / 2 / a0;
+            b1 = (1 - cos_omega) / a0;
+        } else {
+            b0 = (1 + cos_omega) / 2 / a0;
+            b1 = -(1 + cos_omega) / a0;
+        }
+        b2 = b0;
+        a1 = -2 * cos_omega / a0;
+        a2 = (1 - alpha) / a0;
+        coefficients_for = weight.value;
+    }
+
+    // Every sample depends on the one before, so only the left
+    // and right side are done together.
+#ifdef __SSE2__
+    __m128 vb0 = _mm_set1_ps(b0);
+    __m128 vb1 = _mm_set1_ps(b1);
+    __m128 vb2 = _mm_set1_ps(b2);
+    __m128 va1 = _mm_set1_ps(a1);
+    __m128 va2 = _mm_set1_ps(a2);
+    __m128 s1 = _mm_setr_ps(z1[0], z1[1], 0, 0);
+    __m128 s2 = _mm_setr_ps(z2[0], z2[1], 0, 0);
+    for (u32 i = 0; i < frames; i++) {
+        f64 *frame = (f64 *) (samples + 2 * i);
+        __m128 x = _mm_castpd_ps(_mm_load_sd(frame));
+        __m128 y = _mm_add_ps(_mm_mul_ps(vb0, x), s1);
+        s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(vb1, x), _mm_mul_ps(va1, y)), s2);
+        s2 = _mm_sub_ps(_mm_mul_ps(vb2, x), _mm_mul_ps(va2, y));
+        _mm_store_sd(frame, _mm_castps_pd(y));
+    }
+    f32 state[4];
+    _mm_storeu_ps(state, s1);
+    z1[0] = state[0];
+    z1[1] = state[1];
+    _mm_storeu_ps(state, s2);
+    z2[0] = state[0];
+    z2[1] = state[1];
+#else
+    for (u32 i = 0; i < frames; i++) {
+        for (u32 c = 0; c < 2; c++) {
+            f32 x = samples[2 * i + c];
+            f32 y = b0 * x + z1[c];
+            z1[c] = b1 * x - a1 * y + z2[c];
+            z2[c] = b2 * x - a2 * y;
+            samples[2 * i + c] = y;
+        }
+    }
+#endif
+}
+
+void Biquad::reset() {
+    weight = {1.0, 1.0, 0.0};
+    // Never a weight, so the coefficients are worked out
+    // the first time.
+    coefficients_for = -1.0;
+    z1[0] = z1[1] = 0.0;
+    z2[0] = z2[1] = 0.0;
+}
+
+void EffectChain::add(Effect *effect) {
+    ASSERT(num_effects < MAX_EFFECTS, "Too many effects in the chain");
+    effects[num_effects++] = effect;
+}
+
+void EffectChain::process(f32 *samples, u32 frames) {
+    for (u32 i = 0; i < num_effects; i++) {
+        if (effects[i]->active())
+            effects[i]->process(samples, frames);
+    }
+}
+
+void EffectChain::reset() {
+    for (u32 i = 0; i < num_effects; i++)
+        effects[i]->reset();
+}
+
+}
@@ -0,0 +1,114 @@
+namespace Mixer {
+
+///# Effects
+// Effects change how a channel sounds, like an echo or a filter. Each
+// channel sends its sound through a chain of effects, a block at a
+// time. The samples in a block are interleaved stereo and lie next to
+// each other in memory, so the effects can work on several at once.
+
+///*
+// A value that moves towards a target a little every block, so
+// changes to the effects fade in instead of clicking.
+struct Ramp {
+    f32 value;
+    f32 target;
+    f32 delta;
+
+    // Starts moving towards "target", it's reached after
+    // "blocks" blocks. Jumps straight there if "blocks" is
+    // less than one.
+    void set(f32 target, f32 blocks);
+    // Moves the value one block closer to the target.
+    void step();
+};
+
+///*
+// The base of all effects. "process" is called on the audio thread
+// with "frames" interleaved stereo frames, and changes them in place.
+// Effects that aren't active are skipped by the chain.
+struct Effect {
+    virtual bool active() const = 0;
+    virtual void process(f32 *samples, u32 frames) = 0;
+    // Forgets everything that's been played through the
+    // effect, and turns it off.
+    virtual void reset() = 0;
+};
+
+///*
+// An echo, the sound from "seconds" ago is added back in, scaled
+// by "feedback".
+struct Delay : public Effect {
+    // What the effect has played, the echo is read from here.
+    f32 *buffer;
+    u32 capacity;
+    u32 head;
+    f32 sample_rate;
+    // Set when the effect starts, since the buffer holds sound
+    // from the last time it was on.
+    bool stale;
+
+    Ramp feedback;
+    Ramp seconds;
+
+    // "buffer" holds "capacity" samples, which is the longest echo.
+    void init(f32 *buffer, u32 capacity, f32 sample_rate);
+    void set(f32 feedback, f32 seconds, f32 blocks);
+
+    bool active() const override;
+    void process(f32 *samples, u32 frames) override;
+    void reset() override;
+};
+
+///*
+// A second order filter, used as a lowpass or a highpass. The
+// coefficients are only worked out again when the weight changes.
+struct Biquad : public Effect {
+    enum Kind {
+        LOWPASS,
+        HIGHPASS,
+    } kind;
+    f32 sample_rate;
+
+    // 1 lets everything through, lower values filter more.
+    Ramp weight;
+
+    f32 b0, b1, b2;
+    f32 a1, a2;
+    // The weight the coefficients were worked out for.
+    f32 coefficients_for;
+    // The memory of the filter, for the left and right side.
+    f32 z1[2];
+    f32 z2[2];
+
+    void init(Kind kind, f32 sample_rate);
+    void set(f32 weight, f32 blocks);
+
+    bool active() const override;
+    void process(f32 *samples, u32 frames) override;
+    void reset() override;
+};
+
+///*
+// A list of effects that are applied in order.
+struct EffectChain {
+    static constexpr u32 MAX_EFFECTS = 8;
+
+    Effect *effects[MAX_EFFECTS];
+    u32 num_effects;
+
+    // Adds an effect to the end of the chain, the effect has to
+    // live as long as the chain.
+    void add(Effect *effect);
+    void process(f32 *samples, u32 frames);
+    void reset();
+};
+
+///*
+// Adds "from" times "scale" to "to", "count" samples.
+void add_samples(f32 *to, const f32 *from, f32 scale, u32 count);
+
+///*
+// Clamps every sample between -"limit" and "limit".
+void clamp_samples(f32 *samples, f32 limit, u32 count);
+
+}
@@ -1,7 +1,11 @@
+#include <algorithm>
+
 namespace Mixer {
 
 struct SoundSource {
-    f32 sample;
+    // Where the next frame is taken from in the sound, in
+    // fixed point.
+    u64 cursor;
     AssetID source;
     u32 channel;
     f32 pitch;
@@ -11,126 +15,298 @@ struct SoundSource {
     Vec2 position;
 
     u8 gen;
+    // Kept in memory while the source is playing.
+    Sound *sound;
+    // Set if the sound is streamed.
+    Asset::SoundStream *stream;
+
+    // The gain for each side at the listener, only worked out
+    // again if it's from an older generation of the listener.
+    f32 spatial_gain[2];
+    u32 spatial_generation;
+
+    u32 priority;
+    // The voice the source is mixed with, or NO_VOICE
+    // if it's virtual.
+    u16 voice;
+    // Where the source is in the list of active sources.
+    u16 active_index;
+};
+
+// A source that's mixed, there are only a few of these so
+// they can hold what's needed to resample the source.
+struct Voice {
+    u16 source;
+    // The next frame to read from the sound, and the frames
+    // before it that the resampler still needs.
+    s64 next_frame;
+    f32 history[2][Util::RESAMPLE_TAPS];
+    // The gains at the end of the last block, the next
+    // block fades from these.
+    f32 gain[2];
+};
+
+constexpr u16 NO_VOICE = 0xFFFF;
+// Sources quieter than this aren't worth mixing.
+constexpr f32 AUDIBLE_GAIN = 0.001;
+
+// Where the sounds are heard from. The generation goes up
+// when anything changes, and is never 0.
+struct Listener {
+    Vec2 position;
+    Attenuation curve;
+    f32 min_distance;
+    f32 max_distance;
+    f32 rolloff;
+    u32 generation;
 };
 
 struct AudioStruct {
     SoundSource sources[NUM_SOURCES];
     u16 num_free_sources;
     u16 free_sources[NUM_SOURCES];
+    // The sources that are playing, mixed or not.
+    u16 num_active_sources;
+    u16 active_sources[NUM_SOURCES];
+
+    Voice voices[NUM_VOICES];
+    u16 num_free_voices;
+    u16 free_voices[NUM_VOICES];
+
     Channel channels[NUM_CHANNELS];
+    Bus buses[NUM_BUSES];
+    // The voiced sources on each channel this block, in the
+    // order they're mixed.
+    u16 num_channel_sources[NUM_CHANNELS];
+    u16 channel_sources[NUM_CHANNELS][NUM_VOICES];
+    // Set for the sources that ended while they were mixed.
+    bool ended[NUM_SOURCES];
     u32 sample_index;
-    // Position of the listener
-    Vec2 position;
     f32 time;
     f32 time_step;
 
+    Listener listener;
+
+    Util::Resampling resampling;
+    Util::ResampleTable resample_tables[Util::NUM_RESAMPLE_TABLES];
+
+    // Set when there's no audio device, and the sound
+    // is made by "render_offline" instead.
+    bool offline;
     SDL_AudioDeviceID dev;
 } audio_struct = {};
 
-void add(f32 *value, f32 target, f32 delta) {
-    if (delta > 0 && *value < target) {
-        *value = MIN(*value + delta, target);
-    } else if (delta < 0 && *value > target) {
-        *value = MAX(*value + delta, target);
-    }
+// The effects move one step every block.
+static constexpr f32 BLOCKS_PER_SECOND = (f32) AUDIO_SAMPLE_RATE / AUDIO_SAMPLES_WANT;
+
+void Channel::set_delay(f32 feedback, f32 len_seconds, f32 in_seconds) {
+    lock_audio();
+    delay.set(feedback, len_seconds, in_seconds * BLOCKS_PER_SECOND);
+    unlock_audio();
 }
 
-void Channel::effect(u32 start, u32 len) {
-    if (delay) {
-        add(&delay.feedback, delay.feedback_target, delay.feedback_delta);
-        add(&delay.len_seconds, delay.len_seconds_target, delay.len_seconds_delta);
-        if (delay.len_seconds != delay._prev_len_seconds) {
-            //TODO(GS) crackling when length is changed while sound is playing
-            delay.len = (u32) AUDIO_SAMPLE_RATE * delay.len_seconds * 2;
-            delay._prev_len_seconds = delay.len_seconds;
-        }
-        for (u32 i = 0; i < len; i++) {
-            u32 cur_pos = (start + i) % CHANNEL_BUFFER_LENGTH;
-            u32 pre_pos = (start + i - delay.len + CHANNEL_BUFFER_LENGTH) % CHANNEL_BUFFER_LENGTH;
-            buffer[cur_pos] += buffer[pre_pos] * delay.feedback;
-        }
+void Bus::set_lowpass(f32 weight, f32 in_seconds) {
+    lock_audio();
+    lowpass.set(weight, in_seconds * BLOCKS_PER_SECOND);
+    unlock_audio();
+}
+
+void Bus::set_highpass(f32 weight, f32 in_seconds) {
+    lock_audio();
+    highpass.set(weight, in_seconds * BLOCKS_PER_SECOND);
+    unlock_audio();
+}
+
+Channel *fetch_channel(u32 channel_id) {
+    ASSERT(channel_id < NUM_CHANNELS, "Invalid channel");
+    return &audio_struct.channels[channel_id];
+}
+
+Bus *fetch_bus(u32 bus_id) {
+    ASSERT(bus_id < NUM_BUSES, "Invalid bus");
+    return &audio_struct.buses[bus_id];
+}
+
+void route_channel(u32 channel_id, u32 bus_id) {
+    ASSERT(channel_id < NUM_CHANNELS, "Invalid channel");
+    ASSERT(bus_id < NUM_BUSES, "Invalid bus");
+    lock_audio();
+    audio_struct.channels[channel_id].parent = bus_id;
+    unlock_audio();
+}
+
+void route_bus(u32 bus_id, u32 to_bus_id) {
+    ASSERT(bus_id < NUM_BUSES && bus_id != MASTER_BUS, "Invalid bus");
+    ASSERT(to_bus_id < bus_id, "A bus can only be sent to a bus with a lower number");
+    lock_audio();
+    audio_struct.buses[bus_id].parent = to_bus_id;
+    unlock_audio();
+}
+
+// Lets go of the sound data, called when the source stops.
+static void release_source(SoundSource *source) {
+    if (source->stream)
+        Asset::close_stream(source->stream);
+    else
+        Asset::release_sound(source->source);
+}
+
+// How much quieter a sound is "distance" away from the listener.
+static f32 attenuate(const Listener *listener, f32 distance) {
+    if (listener->curve == Attenuation::NONE) return 1.0;
+    if (distance > listener->max_distance) return 0.0;
+    f32 min = listener->min_distance;
+    f32 beyond = MAX(distance - min, 0.0f) * listener->rolloff;
+    switch (listener->curve) {
+        case Attenuation::LINEAR:
+            return MAX(1.0f - beyond / MAX(listener->max_distance - min, 0.0001f), 0.0f);
+        case Attenuation::INVERSE:
+            return min / (min + beyond);
+        case Attenuation::INVERSE_SQUARE:
+            return (min / (min + beyond)) * (min / (min + beyond));
+        default:
+            UNREACHABLE;
     }
-    if (lowpass) {
-        lowpass.weight_target = CLAMP(0, 1, lowpass.weight_target);
-        add(&lowpass.weight, lowpass.weight_target, lowpass.weight_delta);
-        f32 weight = lowpass._SENSITIVITY * pow(2.718,
-                log(lowpass.weight * (1+lowpass._SENSITIVITY) / lowpass._SENSITIVITY)) - lowpass._SENSITIVITY;
-        for (u32 i = 0; i < len; i += 2) {
-            u32 pos = (start + i) % CHANNEL_BUFFER_LENGTH;
-            lowpass.sum[0] -= (weight * (lowpass.sum[0] - buffer[pos+0]));
-            lowpass.sum[1] -= (weight * (lowpass.sum[1] - buffer[pos+1]));
-            buffer[pos+0] = lowpass.sum[0];
-            buffer[pos+1] = lowpass.sum[1];
-        }
+    return 1.0;
+}
+
+// Works out the gain for each side, if the source or the
+// listener has moved since the last time.
+static void spatialize(AudioStruct *data, SoundSource *source) {
+    if (source->spatial_generation == data->listener.generation) return;
+    source->spatial_generation = data->listener.generation;
+    if (!source->positional) {
+        source->spatial_gain[0] = source->spatial_gain[1] = source->gain;
+        return;
     }
-    if (highpass) {
-        highpass.weight_target = CLAMP(0, 1, highpass.weight_target);
-        add(&highpass.weight, highpass.weight_target, highpass.weight_delta);
-        f32 weight = highpass._SENSITIVITY * pow(2.718,
-                log(highpass.weight * (1+highpass._SENSITIVITY) / highpass._SENSITIVITY)) - highpass._SENSITIVITY;
-        for (u32 i = 0; i < len; i += 2) {
-            u32 pos = (start + i) % CHANNEL_BUFFER_LENGTH;
-            highpass.sum[0] -= ((1 - weight) * (highpass.sum[0] - buffer[pos+0]));
-            highpass.sum[1] -= ((1 - weight) * (highpass.sum[1] - buffer[pos+1]));
-            buffer[pos+0] -= highpass.sum[0];
-            buffer[pos+1] -= highpass.sum[1];
-        }
+    Vec2 distance = source->position - data->listener.position;
+    f32 length = ::length(distance);
+    f32 gain = source->gain * attenuate(&data->listener, length);
+    // Sounds close to the listener are panned less, so they
+    // don't jump from side to side when they pass.
+    f32 pan = length > 0.0 ? distance.x / MAX(length, data->listener.min_distance) : 0.0;
+    // Equal power, so the sound is as loud wherever it's panned.
+    f32 angle = (CLAMP(-1.0f, 1.0f, pan) + 1.0) * (M_PI / 4.0);
+    f32 left = cos(angle);
+    f32 right = sin(angle);
+    if (source->sound->is_stereo) {
+        // Both sides are kept, the far side is turned down.
+        left = MIN(left * (f32) M_SQRT2, 1.0f);
+        right = MIN(right * (f32) M_SQRT2, 1.0f);
     }
+    source->spatial_gain[0] = gain * left;
+    source->spatial_gain[1] = gain * right;
 }
 
-void Channel::set_delay(f32 feedback, f32 len_seconds, f32 in_seconds) {
-    delay.feedback_target = feedback;
-    delay.len_seconds_target = len_seconds;
-    delay.feedback_delta = (delay.feedback_target - delay.feedback) / (in_seconds * AUDIO_SAMPLE_RATE / (AUDIO_SAMPLES_WANT * 2));
-    delay.len_seconds_delta = (delay.len_seconds_target - delay.len_seconds) / (in_seconds * AUDIO_SAMPLE_RATE / (AUDIO_SAMPLES_WANT * 2));
+// How loud the source is at the listener.
+static f32 audibility(AudioStruct *data, SoundSource *source) {
+    spatialize(data, source);
+    return MAX(ABS(source->spatial_gain[0]), ABS(source->spatial_gain[1]));
 }
 
-void Channel::set_lowpass(f32 weight, f32 in_seconds) {
-    ASSERT(0 <= weight && weight <= 1, "Weight needs to be between 0 and 1.");
-    lowpass.weight_target = weight;
-    lowpass.weight_delta = (lowpass.weight_target - lowpass.weight) / (in_seconds * AUDIO_SAMPLE_RATE / (AUDIO_SAMPLES_WANT * 2));
+// True if "a" should be mixed before "b".
+static bool more_important(u32 priority_a, f32 audibility_a,
+                           u32 priority_b, f32 audibility_b) {
+    if (priority_a != priority_b) return priority_a > priority_b;
+    return audibility_a > audibility_b;
 }
 
-void Channel::set_highpass(f32 weight, f32 in_seconds) {
-    ASSERT(0 <= weight && weight <= 1, "Weight needs to be between 0 and 1.");
-    highpass.weight_target = weight;
-    highpass.weight_delta = (highpass.weight_target - highpass.weight) / (in_seconds * AUDIO_SAMPLE_RATE / (AUDIO_SAMPLES_WANT * 2));
+static void free_voice(AudioStruct *data, SoundSource *source) {
+    if (source->voice == NO_VOICE) return;
+    data->free_voices[data->num_free_voices++] = source->voice;
+    source->voice = NO_VOICE;
 }
 
-Channel *fetch_channel(u32 channel_id) {
-    ASSERT(channel_id < NUM_CHANNELS, "Invalid channel");
-    return &audio_struct.channels[channel_id];
+// Stops the source and gives back the slot, the audio
+// has to be locked.
+static bool is_active(AudioStruct *data, u16 source_id) {
+    u16 index = data->sources[source_id].active_index;
+    return index < data->num_active_sources && data->active_sources[index] == source_id;
+}
+
+static void remove_source(AudioStruct *data, u16 source_id) {
+    SoundSource *source = data->sources + source_id;
+    u16 moved = data->active_sources[--data->num_active_sources];
+    data->active_sources[source->active_index] = moved;
+    data->sources[moved].active_index = source->active_index;
+    free_voice(data, source);
+    data->free_sources[data->num_free_sources++] = source_id;
+    source->gain = 0.0;
+    release_source(source);
+}
+
+// Finds the least important source, which is stopped
+// if the new source is more important.
+static bool steal_source(AudioStruct *data, SoundSource *source) {
+    f32 new_audibility = audibility(data, source);
+    u16 victim = NUM_SOURCES;
+    f32 victim_audibility = 0.0;
+    for (u32 i = 0; i < data->num_active_sources; i++) {
+        u16 id = data->active_sources[i];
+        SoundSource *other = data->sources + id;
+        f32 other_audibility = audibility(data, other);
+        if (victim == NUM_SOURCES ||
+            more_important(data->sources[victim].priority, victim_audibility,
+                           other->priority, other_audibility)) {
+            victim = id;
+            victim_audibility = other_audibility;
+        }
+    }
+    if (victim == NUM_SOURCES ||
+        more_important(data->sources[victim].priority, victim_audibility,
+                       source->priority, new_audibility))
+        return false;
+    remove_source(data, victim);
+    return true;
 }
 
 AudioID push_sound(SoundSource source) {
+    // Read in here, so the audio thread never has to.
+    if (Asset::is_streamed(source.source)) {
+        source.stream = Asset::open_stream(source.source);
+        if (!source.stream) {
+            ERR("Not enough free streams, skipping playing of sound");
+            return {0, NUM_SOURCES};
+        }
+        source.sound = &source.stream->sound;
+    } else {
+        source.sound = Asset::fetch_sound(source.source);
+        Asset::retain_sound(source.source);
+    }
+    source.voice = NO_VOICE;
     lock_audio();
-    if (audio_struct.num_free_sources) {
+    if (audio_struct.num_free_sources || steal_source(&audio_struct, &source)) {
         u16 source_id =
             audio_struct.free_sources[--audio_struct.num_free_sources];
         source.gen = audio_struct.sources[source_id].gen + 1;
+        source.active_index = audio_struct.num_active_sources;
+        audio_struct.active_sources[audio_struct.num_active_sources++] = source_id;
         audio_struct.sources[source_id] = source;
         unlock_audio();
         return {source.gen, source_id};
-    } else {
-        ERR("Not enough free sources, skipping playing of sound");
     }
     unlock_audio();
+    release_source(&source);
     return {0, NUM_SOURCES};
 }
 
 AudioID play_sound(u32 channel_id, AssetID asset_id, f32 pitch, f32 gain, f32 pitch_variance,
-                   f32 gain_variance, bool loop) {
+                   f32 gain_variance, bool loop, u32 priority) {
     ASSERT(channel_id < NUM_CHANNELS, "Invalid channel");
-    return push_sound({0, asset_id, channel_id, pitch + random_real(-1, 1) * pitch_variance,
-                       gain + random_real(-1, 1) * gain_variance, loop});
+    SoundSource source = {0, asset_id, channel_id, pitch + random_real(-1, 1) * pitch_variance,
+                          gain + random_real(-1, 1) * gain_variance, loop};
+    source.priority = priority;
+    return push_sound(source);
 }
 
 AudioID play_sound_at(u32 channel_id, AssetID asset_id, Vec2 position, f32 pitch, f32 gain,
-                      f32 pitch_variance, f32 gain_variance, bool loop) {
+                      f32 pitch_variance, f32 gain_variance, bool loop, u32 priority) {
     ASSERT(channel_id < NUM_CHANNELS, "Invalid channel");
-    return push_sound({0, asset_id, channel_id, pitch + random_real(-1, 1) * pitch_variance,
-                       gain + random_real(-1, 1) * gain_variance, loop, true,
-                       position});
+    SoundSource source = {0, asset_id, channel_id, pitch + random_real(-1, 1) * pitch_variance,
+                          gain + random_real(-1, 1) * gain_variance, loop, true,
+                          position};
+    source.priority = priority;
+    return push_sound(source);
 }
 
 void stop_sound(AudioID id) {
@@ -138,148 +314,457 @@ void stop_sound(AudioID id) {
     lock_audio();
     SoundSource *source = audio_struct.sources + id.slot;
     CHECK(source->gen == id.gen, "Invalid AudioID, the handle is outdated");
-    if (source->gen == id.gen) {
-        audio_struct.free_sources[audio_struct.num_free_sources++] = id.slot;
-        source->gain = 0.0;
+    if (source->gen == id.gen && is_active(&audio_struct, id.slot)) {
+        remove_source(&audio_struct, id.slot);
     } else {
         ERR("Invalid removal of AudioID that does not exist");
     }
     unlock_audio();
 }
 
+void move_sound(AudioID id, Vec2 position) {
+    ASSERT(id.slot < NUM_SOURCES, "Invalid index in ID");
+    lock_audio();
+    SoundSource *source = audio_struct.sources + id.slot;
+    if (source->gen == id.gen && is_active(&audio_struct, id.slot)) {
+        CHECK(source->positional, "Only sounds played at a position can move");
+        source->position = position;
+        source->spatial_generation = 0;
+    }
+    unlock_audio();
+}
+
+void set_listener(Vec2 position) {
+    lock_audio();
+    if (!(audio_struct.listener.position == position)) {
+        audio_struct.listener.position = position;
+        audio_struct.listener.generation++;
+    }
+    unlock_audio();
+}
+
+void listen_from_camera(u32 camera_id) {
+    // The camera position is the negated center of the view.
+    set_listener(-Renderer::get_camera(camera_id)->position);
+}
+
+void set_attenuation(Attenuation curve, f32 min_distance, f32 max_distance, f32 rolloff) {
+    ASSERT(0 < min_distance && min_distance <= max_distance, "Invalid distances");
+    lock_audio();
+    audio_struct.listener.curve = curve;
+    audio_struct.listener.min_distance = min_distance;
+    audio_struct.listener.max_distance = max_distance;
+    audio_struct.listener.rolloff = rolloff;
+    audio_struct.listener.generation++;
+    unlock_audio();
+}
+
+void set_resampling(Util::Resampling mode) {
+    lock_audio();
+    audio_struct.resampling = mode;
+    unlock_audio();
+}
+
 void lock_audio() {
+    if (audio_struct.offline) return;
     SDL_LockAudioDevice(audio_struct.dev);
 }
 
 void unlock_audio() {
+    if (audio_struct.offline) return;
     SDL_UnlockAudioDevice(audio_struct.dev);
 }
 
 #define S16_TO_F32(S) ((f32) (S) / ((f32) 0xEFFF))
 
-void audio_callback(void* userdata, u8* stream, int len) {
-    START_PERF(AUDIO);
-    const u32 SAMPLES = len / sizeof(f32);
-    AudioStruct *data = (AudioStruct *) userdata;
-    f32 *output_stream = (f32*) stream;
-    const f32 TIME_STEP = data->time_step;
-
-    u32 base = audio_struct.sample_index;
-    for (u32 channel_id = 0; channel_id < NUM_CHANNELS; channel_id++) {
-        for (u32 i = 0; i < SAMPLES; i++)
-            audio_struct.channels[channel_id].buffer[(base + i) % CHANNEL_BUFFER_LENGTH] = 0.0;
+// Reads the frame at "index" as floats, mono sounds only
+// write "left". Streams that haven't caught up are silent.
+static void read_frame(SoundSource *source, u64 index, f32 *left, f32 *right) {
+    Sound *sound = source->sound;
+    u32 frame_size = (1 + sound->is_stereo) * sound->bits_per_sample / 8;
+    const u8 *frame;
+    if (source->stream) {
+        frame = Asset::stream_frame(source->stream, index, audio_struct.offline);
+        if (!frame) {
+            *left = *right = 0;
+            return;
+        }
+    } else {
+        frame = sound->data + index * frame_size;
     }
 
-    START_PERF(AUDIO_SOURCES);
-    f32 left_fade[NUM_SOURCES];
-    f32 right_fade[NUM_SOURCES];
-    for (u32 source_id = 0; source_id < NUM_SOURCES; source_id++) {
-        SoundSource *source = data->sources + source_id;
-        if (source->positional && source->gain != 0) {
-            Vec2 distance = source->position - data->position;
-            f32 distance_sq = length_squared(distance);
-            f32 falloff = 1.0 / MAX(1.0, distance_sq);
-            // NOTE(ed): The lengths cancel out, so this is linear
-            // falloff.
-            f32 left_dot = dot(distance, V2(1, 0));
-            left_fade[source_id] = (left_dot + 1.0) / 2.0 * falloff;
-            f32 right_dot = dot(distance, V2(-1, 0));
-            right_fade[source_id] = (right_dot + 1.0) / 2.0 * falloff;
-        }
+    if (sound->bits_per_sample == 16) {
+        const s16 *samples = (const s16 *) frame;
+        *left = S16_TO_F32(samples[0]);
+        if (sound->is_stereo)
+            *right = S16_TO_F32(samples[1]);
+    } else if (sound->bits_per_sample == 32) {
+        const f32 *samples = (const f32 *) frame;
+        *left = samples[0];
+        if (sound->is_stereo)
+            *right = samples[1];
+    } else {
+        UNREACHABLE;
     }
+}
 
+// Frames are resampled in blocks, so the frames they're made
+// from fit on the stack.
+constexpr u32 RESAMPLE_BLOCK = 256;
+// The pitch is clamped so a block never reads more than this
+// many frames per output frame.
+constexpr u32 MAX_RESAMPLE_STEP = 8;
+constexpr u32 MAX_RESAMPLE_INPUT = 2 * Util::RESAMPLE_TAPS + MAX_RESAMPLE_STEP * RESAMPLE_BLOCK;
+
+// How far the source moves in the sound for each frame
+// that's mixed, in fixed point.
+static u64 source_step(AudioStruct *data, SoundSource *source) {
+    f64 rate = source->sound->sample_rate * source->pitch * data->time_step;
+    return CLAMP(0.0, (f64) MAX_RESAMPLE_STEP, rate) * Util::RESAMPLE_ONE;
+}
 
-    for (u32 source_id = 0; source_id < NUM_SOURCES; source_id++) {
-        f32 time = 0;
-        for (u32 i = 0; i < SAMPLES; i += 2) {
-            time += TIME_STEP;
-            SoundSource *source = data->sources + source_id;
-            if (source->gain == 0.0) break;
-            Sound *sound = Asset::fetch_sound(source->source);
-            source->sample += sound->sample_rate * source->pitch * TIME_STEP;
-            u64 index = source->sample;
-            if (index >= sound->num_samples) {
-                if (source->looping) {
-                    index = 0;
-                    source->sample = 0;
-                } else {
-                    data->free_sources[data->num_free_sources++] = source_id;
-                    source->gain = 0.0;
-                    break;
-                }
-            }
+// Moves a virtual source forward without mixing it. Returns
+// false if the sound ended.
+static bool advance_source(AudioStruct *data, SoundSource *source, u32 frames) {
+    u64 end = source->sound->num_samples << Util::RESAMPLE_FRACTION_BITS;
+    if (!end) return false;
+    source->cursor += source_step(data, source) * frames;
+    if (!source->looping) return source->cursor < end;
+    source->cursor %= end;
+    return true;
+}
 
-            f32 left;
-            f32 right;
-            if (sound->is_stereo) {
-                if (sound->bits_per_sample == 16) {
-                    left = S16_TO_F32(sound->samples_16[index * 2 + 0]);
-                    right = S16_TO_F32(sound->samples_16[index * 2 + 1]);
-                } else if (sound->bits_per_sample == 32) {
-                    left = sound->samples_32[index * 2 + 0];
-                    right = sound->samples_32[index * 2 + 1];
-                } else {
-                    UNREACHABLE;
-                }
-                left *= source->gain;
-                right *= source->gain;
+// Resamples "frames" frames from the source and adds them to the
+// block of its channel, starting at frame "offset". Returns false
+// if the sound ended.
+static bool mix_source(AudioStruct *data, SoundSource *source, Voice *voice,
+                       u32 offset, u32 frames) {
+    using namespace Util;
+    Sound *sound = source->sound;
+    if (!sound->num_samples) return false;
+    u64 step = source_step(data, source);
+    const ResampleTable *table = data->resample_tables + resample_table_for(step);
+    u64 end = sound->num_samples << RESAMPLE_FRACTION_BITS;
+    f32 *block = data->channels[source->channel].block + 2 * offset;
+    u32 channels = 1 + sound->is_stereo;
+    f32 from_gain[2] = {voice->gain[0], voice->gain[1]};
+    f32 gain_step[2] = {source->spatial_gain[0] - from_gain[0],
+                        source->spatial_gain[1] - from_gain[1]};
+    voice->gain[0] = source->spatial_gain[0];
+    voice->gain[1] = source->spatial_gain[1];
+
+    f32 input[2][MAX_RESAMPLE_INPUT];
+    f32 output[2][RESAMPLE_BLOCK];
+    for (u32 done = 0; done < frames;) {
+        if (!source->looping && source->cursor >= end) return false;
+        u32 count = MIN(RESAMPLE_BLOCK, frames - done);
+        if (!source->looping && step)
+            count = MIN((u64) count, (end - source->cursor + step - 1) / step);
+
+        // The input starts with the frames kept from the last block,
+        // and then the frames up to the last tap of this block.
+        u64 last_position = source->cursor + (count - 1) * step;
+        s64 last_frame = (s64) (last_position >> RESAMPLE_FRACTION_BITS) + RESAMPLE_HALF_TAPS;
+        u32 num_new = MAX(last_frame + 1 - voice->next_frame, (s64) 0);
+        for (u32 c = 0; c < channels; c++)
+            copy_bytes(voice->history[c], input[c], sizeof(voice->history[c]));
+        for (u32 i = 0; i < num_new; i++) {
+            u64 index = voice->next_frame + i;
+            f32 *left = input[0] + RESAMPLE_TAPS + i;
+            f32 *right = input[1] + RESAMPLE_TAPS + i;
+            if (source->looping) {
+                read_frame(source, index % sound->num_samples, left, right);
+            } else if (index < sound->num_samples) {
+                read_frame(source, index, left, right);
             } else {
-                f32 sample;
-                if (sound->bits_per_sample == 16) {
-                    sample = S16_TO_F32(sound->samples_16[index]);
-                } else if (sound->bits_per_sample == 32) {
-                    sample = sound->samples_32[index];
-                } else {
-                    UNREACHABLE;
-                }
-
-                // Distance blending
-                left = sample * source->gain;
-                right = sample * source->gain;
-                if (source->positional) {
-                    left *= left_fade[source_id];
-                    right *= right_fade[source_id];
-                }
+                *left = *right = 0.0;
             }
-            u32 sample_index = (audio_struct.sample_index + i) % CHANNEL_BUFFER_LENGTH;
-            audio_struct.channels[source->channel].buffer[sample_index+0] += left;
-            audio_struct.channels[source->channel].buffer[sample_index+1] += right;
         }
+        for (u32 c = 0; c < channels; c++)
+            copy_bytes(input[c] + num_new, voice->history[c], sizeof(voice->history[c]));
+
+        // The resampler takes the position relative to the
+        // start of the input, so it's moved there and back.
+        s64 first_tap = voice->next_frame - RESAMPLE_HALF_TAPS - 1;
+        u64 position = source->cursor - (u64) first_tap * RESAMPLE_ONE;
+        position = resample(data->resampling, table, input[0],
+                            sound->is_stereo ? input[1] : nullptr,
+                            position, step, output[0], output[1], count);
+        source->cursor = position + (u64) first_tap * RESAMPLE_ONE;
+        voice->next_frame += num_new;
+
+        // The gains fade over the whole call, so there's no
+        // step when the source or the listener moves.
+        const f32 *right = sound->is_stereo ? output[1] : output[0];
+        f32 *to = block + 2 * done;
+        for (u32 i = 0; i < count; i++) {
+            f32 t = (f32) (done + i + 1) / frames;
+            to[2 * i + 0] += output[0][i] * (from_gain[0] + gain_step[0] * t);
+            to[2 * i + 1] += right[i] * (from_gain[1] + gain_step[1] * t);
+        }
+        done += count;
+
+        if (source->looping && source->cursor >= end) {
+            u64 loops = source->cursor / end;
+            source->cursor -= loops * end;
+            voice->next_frame -= loops * sound->num_samples;
+        }
+    }
+    return source->looping || source->cursor < end;
+}
+
+// Mixes the voiced sources on a channel into its block.
+static void mix_channel(AudioStruct *data, u32 channel_id, u32 frames) {
+    f32 *block = data->channels[channel_id].block;
+    for (u32 i = 0; i < frames * 2; i++)
+        block[i] = 0.0;
+    for (u32 i = 0; i < data->num_channel_sources[channel_id]; i++) {
+        u16 source_id = data->channel_sources[channel_id][i];
+        SoundSource *source = data->sources + source_id;
+        data->ended[source_id] = !mix_source(data, source, data->voices + source->voice, 0, frames);
+    }
+}
+
+// Sums up what's sent to the bus and runs its effects, the
+// channels and buses sent to it have to be done.
+static void sum_bus(AudioStruct *data, u32 bus_id, u32 frames) {
+    Bus *bus = data->buses + bus_id;
+    for (u32 i = 0; i < frames * 2; i++)
+        bus->block[i] = 0.0;
+    for (u32 i = 0; i < NUM_CHANNELS; i++) {
+        if (data->channels[i].parent == bus_id)
+            add_samples(bus->block, data->channels[i].block, 1.0, frames * 2);
+    }
+    for (u32 i = bus_id + 1; i < NUM_BUSES; i++) {
+        if (data->buses[i].parent == bus_id)
+            add_samples(bus->block, data->buses[i].block, 1.0, frames * 2);
+    }
+    bus->effects.process(bus->block, frames);
+}
+
+// The graph is split up into the channels and buses sent
+// straight to master, which don't depend on each other.
+struct Subtree {
+    bool is_bus;
+    u32 id;
+};
+
+// Runs the effects on everything in the subtree, from the
+// channels and up.
+static void process_subtree(AudioStruct *data, Subtree subtree, u32 frames) {
+    if (!subtree.is_bus) {
+        Channel *channel = data->channels + subtree.id;
+        channel->effects.process(channel->block, frames);
+        return;
+    }
+    for (u32 i = 0; i < NUM_CHANNELS; i++) {
+        if (data->channels[i].parent == subtree.id)
+            process_subtree(data, {false, i}, frames);
+    }
+    for (u32 i = subtree.id + 1; i < NUM_BUSES; i++) {
+        if (data->buses[i].parent == subtree.id)
+            process_subtree(data, {true, i}, frames);
+    }
+    sum_bus(data, subtree.id, frames);
+}
+
+// Mixes at most AUDIO_SAMPLES_WANT frames into "out".
+static void mix_block(AudioStruct *data, f32 *out, u32 frames) {
+    const u32 SAMPLES = frames * 2;
+
+    START_PERF(AUDIO_SOURCES);
+    // Only the most important sources that can be heard are
+    // mixed, the rest are virtual and just move forward.
+    u16 audible[NUM_SOURCES];
+    f32 loudness[NUM_SOURCES];
+    u32 num_audible = 0;
+    for (u32 i = 0; i < data->num_active_sources; i++) {
+        u16 source_id = data->active_sources[i];
+        SoundSource *source = data->sources + source_id;
+        loudness[source_id] = audibility(data, source);
+        if (loudness[source_id] >= AUDIBLE_GAIN)
+            audible[num_audible++] = source_id;
+    }
+    if (num_audible > NUM_VOICES) {
+        std::nth_element(audible, audible + NUM_VOICES, audible + num_audible,
+                         [data, &loudness](u16 a, u16 b) {
+            return more_important(data->sources[a].priority, loudness[a],
+                                  data->sources[b].priority, loudness[b]);
+        });
+        for (u32 i = NUM_VOICES; i < num_audible; i++)
+            free_voice(data, data->sources + audible[i]);
+        num_audible = NUM_VOICES;
+    }
+    for (u32 i = 0; i < data->num_active_sources; i++) {
+        SoundSource *source = data->sources + data->active_sources[i];
+        if (loudness[data->active_sources[i]] < AUDIBLE_GAIN)
+            free_voice(data, source);
+    }
+    for (u32 i = 0; i < num_audible; i++) {
+        SoundSource *source = data->sources + audible[i];
+        if (source->voice != NO_VOICE) continue;
+        // The resampler starts over, the frames before the
+        // cursor are taken as silence.
+        source->voice = data->free_voices[--data->num_free_voices];
+        Voice *voice = data->voices + source->voice;
+        voice->source = audible[i];
+        voice->next_frame = source->cursor >> Util::RESAMPLE_FRACTION_BITS;
+        for (u32 c = 0; c < 2; c++)
+            for (u32 t = 0; t < Util::RESAMPLE_TAPS; t++)
+                voice->history[c][t] = 0.0;
+        // Sounds that just started play at full volume straight
+        // away, sounds that were virtual fade in.
+        bool started = source->cursor == 0;
+        voice->gain[0] = started ? source->spatial_gain[0] : 0.0;
+        voice->gain[1] = started ? source->spatial_gain[1] : 0.0;
+    }
+
+    // The sources are sorted by channel, in the same order
+    // they're walked through below.
+    for (u32 i = 0; i < NUM_CHANNELS; i++)
+        data->num_channel_sources[i] = 0;
+    for (s32 i = data->num_active_sources - 1; i >= 0; i--) {
+        u16 source_id = data->active_sources[i];
+        SoundSource *source = data->sources + source_id;
+        if (source->voice == NO_VOICE) continue;
+        u32 channel = source->channel;
+        data->channel_sources[channel][data->num_channel_sources[channel]++] = source_id;
+    }
+
+    // Each channel is mixed by one thread, in a fixed order,
+    // so the sound is the same however many threads there are.
+    bool parallel = Util::num_workers() && num_audible >= PARALLEL_VOICES;
+    if (parallel) {
+        Util::parallel_for(NUM_CHANNELS, 1, [data, frames](u32 begin, u32 end) {
+            for (u32 i = begin; i < end; i++)
+                mix_channel(data, i, frames);
+        });
+    } else {
+        for (u32 i = 0; i < NUM_CHANNELS; i++)
+            mix_channel(data, i, frames);
+    }
+
+    // Backwards, since removing a source moves the last one.
+    for (s32 i = data->num_active_sources - 1; i >= 0; i--) {
+        u16 source_id = data->active_sources[i];
+        SoundSource *source = data->sources + source_id;
+        bool playing;
+        if (source->voice == NO_VOICE)
+            playing = advance_source(data, source, frames);
+        else
+            playing = !data->ended[source_id];
+        if (!playing)
+            remove_source(data, source_id);
     }
     STOP_PERF(AUDIO_SOURCES);
-    for (u32 i = 0; i < SAMPLES; i++)
-        output_stream[i] = 0.0;
 
     START_PERF(AUDIO_EFFECTS);
-    for (u32 channel_id = 0; channel_id < NUM_CHANNELS; channel_id++) {
-        Channel *channel = &audio_struct.channels[channel_id];
-        channel->effect(base, SAMPLES);
-        for (u32 i = 0; i < SAMPLES; i++) {
-            output_stream[i] += channel->buffer[(base + i) % CHANNEL_BUFFER_LENGTH];
-        }
-
-        for (u32 i = 0; i < SAMPLES; i++) {
-            output_stream[i] = CLAMP(-SAMPLE_LIMIT, SAMPLE_LIMIT, output_stream[i]);
-        }
+    Subtree subtrees[NUM_CHANNELS + NUM_BUSES];
+    u32 num_subtrees = 0;
+    for (u32 i = 0; i < NUM_CHANNELS; i++) {
+        if (data->channels[i].parent == MASTER_BUS)
+            subtrees[num_subtrees++] = {false, i};
+    }
+    for (u32 i = MASTER_BUS + 1; i < NUM_BUSES; i++) {
+        if (data->buses[i].parent == MASTER_BUS)
+            subtrees[num_subtrees++] = {true, i};
     }
+    if (parallel) {
+        Util::parallel_for(num_subtrees, 1, [data, frames, &subtrees](u32 begin, u32 end) {
+            for (u32 i = begin; i < end; i++)
+                process_subtree(data, subtrees[i], frames);
+        });
+    } else {
+        for (u32 i = 0; i < num_subtrees; i++)
+            process_subtree(data, subtrees[i], frames);
+    }
+    sum_bus(data, MASTER_BUS, frames);
+
+    // Only the master bus is clamped, so the channels can
+    // go over the limit as long as they're quiet together.
+    Util::copy_bytes(data->buses[MASTER_BUS].block, out, SAMPLES * sizeof(f32));
+    clamp_samples(out, SAMPLE_LIMIT, SAMPLES);
     STOP_PERF(AUDIO_EFFECTS);
-    audio_struct.sample_index += SAMPLES;  // wraps after ~24h
+    data->sample_index += SAMPLES;  // wraps after ~24h
+}
+
+void audio_callback(void* userdata, u8* stream, int len) {
+    START_PERF(AUDIO);
+    AudioStruct *data = (AudioStruct *) userdata;
+    f32 *output_stream = (f32*) stream;
+#ifdef __SSE__
+    // The filters fade out into tiny numbers that are very slow
+    // to work with, they're flushed to zero instead.
+    u32 control = _mm_getcsr();
+    _mm_setcsr(control | _MM_FLUSH_ZERO_ON);
+#endif
+    // The device can ask for more than a block, the effects
+    // step once per block no matter what.
+    u32 num_frames = len / (2 * sizeof(f32));
+    for (u32 done = 0; done < num_frames;) {
+        u32 frames = MIN(AUDIO_SAMPLES_WANT, num_frames - done);
+        mix_block(data, output_stream + done * 2, frames);
+        done += frames;
+    }
+#ifdef __SSE__
+    _mm_setcsr(control);
+#endif
     STOP_PERF(AUDIO);
 }
 
-bool init() {
+// Puts every source and voice back in the free lists, in the
+// order they're handed out from the start.
+static void reset_free_lists(AudioStruct *data) {
+    ASSERT(!data->num_active_sources, "Sources are still playing");
+    data->num_free_sources = NUM_SOURCES;
+    for (u32 i = 0; i < NUM_SOURCES; i++)
+        data->free_sources[i] = NUM_SOURCES - 1 - i;
+    data->num_free_voices = NUM_VOICES;
+    for (u32 i = 0; i < NUM_VOICES; i++)
+        data->free_voices[i] = i;
+}
+
+static void init_mixer_state() {
     OTHER_THREAD(AUDIO);
     OTHER_THREAD(AUDIO_SOURCES);
     OTHER_THREAD(AUDIO_EFFECTS);
 
     audio_mixer.arena = Util::request_arena();
 
-    audio_struct.num_free_sources = NUM_SOURCES;
-    for (u32 i = 0; i < NUM_SOURCES; i++)
-        audio_struct.free_sources[i] = i;
+    reset_free_lists(&audio_struct);
+
+    for (u32 i = 0; i < NUM_CHANNELS; i++) {
+        Channel *channel = audio_struct.channels + i;
+        channel->block = audio_mixer.arena->push<f32>(AUDIO_SAMPLES_WANT * 2);
+        channel->delay.init(audio_mixer.arena->push<f32>(CHANNEL_BUFFER_LENGTH),
+                            CHANNEL_BUFFER_LENGTH, AUDIO_SAMPLE_RATE);
+        channel->lowpass.init(Biquad::LOWPASS, AUDIO_SAMPLE_RATE);
+        channel->highpass.init(Biquad::HIGHPASS, AUDIO_SAMPLE_RATE);
+        channel->effects.add(&channel->delay);
+        channel->effects.add(&channel->lowpass);
+        channel->effects.add(&channel->highpass);
+    }
+    for (u32 i = 0; i < NUM_BUSES; i++) {
+        Bus *bus = audio_struct.buses + i;
+        bus->block = audio_mixer.arena->push<f32>(AUDIO_SAMPLES_WANT * 2);
+        bus->lowpass.init(Biquad::LOWPASS, AUDIO_SAMPLE_RATE);
+        bus->highpass.init(Biquad::HIGHPASS, AUDIO_SAMPLE_RATE);
+        bus->effects.add(&bus->lowpass);
+        bus->effects.add(&bus->highpass);
+    }
 
-    for (u32 i = 0; i < NUM_CHANNELS; i++)
-        audio_struct.channels[i].buffer = audio_mixer.arena->push<f32>(CHANNEL_BUFFER_LENGTH);
+    Util::init_resample_tables(audio_struct.resample_tables);
+    audio_struct.resampling = Util::Resampling::SINC;
+    audio_struct.time_step = 1.0 / (f32) AUDIO_SAMPLE_RATE;
+    audio_struct.listener.curve = Attenuation::INVERSE_SQUARE;
+    audio_struct.listener.min_distance = 1.0;
+    audio_struct.listener.max_distance = 100.0;
+    audio_struct.listener.rolloff = 1.0;
+    audio_struct.listener.generation = 1;
+}
+
+bool init() {
+    init_mixer_state();
 
     SDL_AudioSpec want = {};
     want.freq = AUDIO_SAMPLE_RATE;
@@ -287,7 +772,6 @@ bool init() {
     want.samples = AUDIO_SAMPLES_WANT;
     want.channels = 2;
     want.callback = audio_callback;
-    audio_struct.time_step = 1.0 / (f32) AUDIO_SAMPLE_RATE;
     want.userdata = (void *) &audio_struct;
 
     // Let SDL handle the translation for us.
@@ -302,4 +786,19 @@ bool init() {
     return true;
 }
 
+bool init_offline() {
+    init_mixer_state();
+    audio_struct.offline = true;
+    return true;
+}
+
+void render_offline(f32 *out, u32 num_frames) {
+    ASSERT(audio_struct.offline, "The mixer is playing on an audio device");
+    for (u32 done = 0; done < num_frames;) {
+        u32 frames = MIN(AUDIO_SAMPLES_WANT, num_frames - done);
+        audio_callback(&audio_struct, (u8 *) (out + done * 2), frames * 2 * sizeof(f32));
+        done += frames;
+    }
+}
+
 };  // namespace Mixer
@@ -14,9 +14,20 @@ namespace Mixer {
 const u64 AUDIO_SAMPLE_RATE = 48000;
 const u32 AUDIO_SAMPLES_WANT = 2048;
 const u32 NUM_EFFECTS = 5;
-const u32 NUM_SOURCES = 32;
+// Sounds that can play at the same time, only the NUM_VOICES
+// most important ones that can be heard are mixed.
+const u32 NUM_SOURCES = 1024;
+const u32 NUM_VOICES = 32;
 const u32 NUM_CHANNELS = 10;
-const u32 CHANNEL_BUFFER_LENGTH_SECONDS = 3;  // ~2MB
+// Bus 0 is the master bus, a bus can only send its sound to
+// a bus with a lower number.
+const u32 NUM_BUSES = 8;
+const u32 MASTER_BUS = 0;
+// With this many voices, the channels and buses are mixed on
+// the worker threads.
+const u32 PARALLEL_VOICES = 16;
+// The longest delay a channel can have.
+const u32 CHANNEL_BUFFER_LENGTH_SECONDS = 3;  // ~1MB
 const u32 CHANNEL_BUFFER_LENGTH = AUDIO_SAMPLE_RATE * CHANNEL_BUFFER_LENGTH_SECONDS * 2;  // two channels
 const f32 SAMPLE_LIMIT = 1.0;
 
@@ -35,49 +46,30 @@ struct AudioID {
     u16 slot;
 };
 
-struct Channel {
-    f32 *buffer;
-
-    struct {
-        f32 feedback;
-        f32 feedback_target;
-        f32 feedback_delta;
-        u32 len;
-        f32 len_seconds;
-        f32 len_seconds_target;
-        f32 len_seconds_delta;
-        f32 _prev_len_seconds;
-        operator bool() const {
-            return len_seconds > 0 || len_seconds_target > 0 || feedback > 0 || feedback_target > 0;
-        }
-    } delay = {};
-    void set_delay(f32 feedback, f32 len_seconds, f32 in_seconds = 1);
+// Buses sum up the sound from channels and other buses, and send
+// it on through their own effects. Every bus ends up in the master
+// bus, which is what's played.
+struct Bus {
+    // The sound on the bus this block, interleaved stereo.
+    f32 *block;
+
+    // The effects are applied in the order they're added,
+    // the built in ones come first.
+    EffectChain effects;
 
-    struct {
-        f32 sum[2];
-        f32 weight = 1;
-        f32 weight_target = 1;
-        f32 weight_delta;
-        const f32 _SENSITIVITY = 0.03;
-        operator bool() const {
-            return weight < 1 || weight_target < 1;
-        }
-    } lowpass = {};
+    Biquad lowpass;
     void set_lowpass(f32 weight, f32 in_seconds = 1);
 
-    struct {
-        f32 sum[2];
-        f32 weight = 1;
-        f32 weight_target = 1;
-        f32 weight_delta;
-        const f32 _SENSITIVITY = 0.03;
-        operator bool() const {
-            return weight < 1 || weight_target < 1;
-        }
-    } highpass = {};
+    Biquad highpass;
     void set_highpass(f32 weight, f32 in_seconds = 1);
 
-    void effect(u32 start, u32 len);
+    // The bus the sound is sent to.
+    u32 parent;
+};
+
+struct Channel : public Bus {
+    Delay delay;
+    void set_delay(f32 feedback, f32 len_seconds, f32 in_seconds = 1);
 };
 
 // TODO(GS) standard effects for common sounds (consts).
@@ -85,8 +77,28 @@ struct Channel {
 // TODO(ed): Some reverb and echo effects would
 // go a long way to create cool atmospheres.
 
+///* Attenuation
+// How positional sounds fade with the distance to the listener.
+// Within the min distance the sounds are as loud as they get, and
+// past the max distance they can't be heard, unless the curve is
+// NONE.
+// <ul>
+//  <li>NONE, the sound doesn't fade.</li>
+//  <li>LINEAR, fades evenly until the max distance.</li>
+//  <li>INVERSE, halves when the distance doubles.</li>
+//  <li>INVERSE_SQUARE, quarters when the distance doubles.</li>
+// </ul>
+// The rolloff scales how quickly the curves fall off.
+enum class Attenuation {
+    NONE,
+    LINEAR,
+    INVERSE,
+    INVERSE_SQUARE,
+};
+
 constexpr f32 AUDIO_DEFAULT_GAIN = 0.2;
 constexpr f32 AUDIO_DEFAULT_VARIANCE = 0.01;
+constexpr u32 AUDIO_DEFAULT_PRIORITY = 100;
 
 // These should not be called unless you really
 // know what you're doing.
@@ -95,6 +107,31 @@ void unlock_audio();
 
 bool init();
 
+///*
+// Sets up the mixer without an audio device, nothing is played
+// and the sound is instead mixed by calling "render_offline".
+// Useful for tests and benchmarks on machines without sound.
+bool init_offline();
+
+///*
+// Mixes "num_frames" stereo frames into "out", as fast as it can.
+// Only works if the mixer was started with "init_offline".
+void render_offline(f32 *out, u32 num_frames);
+
+///*
+// Writes interleaved stereo frames to "path" as a 32 bit
+// float WAV file. Returns false if the file couldn't be written.
+bool write_wav(const char *path, const f32 *frames, u32 num_frames);
+
+///*
+// Plays a scripted mix of sounds, positional sounds, buses and
+// effects offline, with the sounds in the loaded asset file.
+// Prints how many samples are mixed per second and a checksum of
+// the output. The script is mixed a few times, and the checksums
+// have to match each other and "expected_checksum", unless it's 0.
+// The output is written to "wav_path" if it's set.
+bool run_benchmark(const char *wav_path = nullptr, u64 expected_checksum = 0);
+
 ///*
 // Plays a sound in the game world, the sound should have been
 // loaded by the asset system:<br>
@@ -106,13 +143,18 @@ bool init();
 //  <li>pitch_variance, how much random variance there should be applied to the pitch.</li>
 //  <li>gain_variance, how much random variance there should be applied to the gain.</li>
 //  <li>loop, if the sound should loop or not.</li>
+//  <li>priority, sounds with a higher priority are mixed before
+//  louder sounds with a lower one.</li>
 // </ul>
+// If too many sounds are playing the least important one is
+// stopped, unless the new sound is even less important.
 AudioID play_sound(u32 channel_id, AssetID asset_id,
                    f32 pitch = 1.0,
                    f32 gain = AUDIO_DEFAULT_GAIN,
                    f32 pitch_variance = AUDIO_DEFAULT_VARIANCE,
                    f32 gain_variance = AUDIO_DEFAULT_VARIANCE,
-                   bool loop = false);
+                   bool loop = false,
+                   u32 priority = AUDIO_DEFAULT_PRIORITY);
 
 ///*
 // Plays a sound in the game world at a specific place thus the sound
@@ -127,18 +169,61 @@ AudioID play_sound(u32 channel_id, AssetID asset_id,
 //  <li>pitch_variance, how much random variance there should be applied to the pitch.</li>
 //  <li>gain_variance, how much random variance there should be applied to the gain.</li>
 //  <li>loop, if the sound should loop or not.</li>
+//  <li>priority, sounds with a higher priority are mixed before
+//  louder sounds with a lower one.</li>
 // </ul>
+// The sound is panned to the side it's on, stereo sounds too.
+// Sounds that are too far away to be heard aren't mixed, but
+// keep playing so they're in the right place when they're heard.
 AudioID play_sound_at(u32 channel_id, AssetID asset_id,
                       Vec2 position, f32 pitch = 1.0,
                       f32 gain = AUDIO_DEFAULT_GAIN,
                       f32 pitch_variance = AUDIO_DEFAULT_VARIANCE,
                       f32 gain_variance = AUDIO_DEFAULT_VARIANCE,
-                      bool loop = false);
+                      bool loop = false,
+                      u32 priority = AUDIO_DEFAULT_PRIORITY);
 
 ///*
 // Stops a sound from playing.
 void stop_sound(AudioID id);
 
+///*
+// Moves a sound played with "play_sound_at". Sounds that don't
+// move aren't worked out again, unless the listener moves.
+void move_sound(AudioID id, Vec2 position);
+
+///*
+// Sets where the positional sounds are heard from, the engine
+// sets it to the camera every frame.
+void set_listener(Vec2 position);
+
+///*
+// Puts the listener in the middle of what the camera sees, the
+// engine does this with the first camera every frame.
+void listen_from_camera(u32 camera_id = 0);
+
+///*
+// Sets how positional sounds fade with distance, it's
+// INVERSE_SQUARE with a min distance of 1 by default.
+void set_attenuation(Attenuation curve, f32 min_distance = 1.0,
+                     f32 max_distance = 100.0, f32 rolloff = 1.0);
+
+///*
+// Sends the sound on a channel to a bus, instead of to the
+// master bus.
+void route_channel(u32 channel_id, u32 bus_id);
+
+///*
+// Sends the sound on a bus to another bus, "to_bus_id" has to
+// be lower than "bus_id" so the sound can't go around in circles.
+void route_bus(u32 bus_id, u32 to_bus_id);
+
+///*
+// Sets how the sounds are resampled when they're played at
+// another rate than the mixer, or with another pitch.
+// SINC is used by default.
+void set_resampling(Util::Resampling mode);
+
 #ifdef _COMMENTS_
 
 ///*
@@ -146,6 +231,12 @@ void stop_sound(AudioID id);
 // valid.
 Channel *fetch_channel(u32 channel_id);
 
+///*
+// Returns a pointer to a bus, MASTER_BUS is the bus everything
+// ends up in. The buses have a lowpass and a highpass filter, like
+// the channels.
+Bus *fetch_bus(u32 bus_id);
+
 ///*
 // Sets target delay on the channel with the specified settings. The feedback
 // and length is changed over time and reaches their targets after in_seconds
@@ -153,16 +244,21 @@ Channel *fetch_channel(u32 channel_id);
 void Channel::set_delay(f32 feedback, f32 len_seconds, f32 in_seconds = 1.0);
 
 ///*
-// Sets a lowpass filter on the channel with the specified weight reached after
+// Sets a lowpass filter on the channel or bus with the specified weight reached after
 // in_seconds seconds. A higher weight means less sound filtered. Weight needs
 // to be between 0 and 1. Unset by setting weight to 1.
-void Channel::set_lowpass(f32 weight, f32 in_seconds = 1.0);
+void Bus::set_lowpass(f32 weight, f32 in_seconds = 1.0);
 
 ///*
-// Sets a highpass filter on the channel with the specified weight reached
+// Sets a highpass filter on the channel or bus with the specified weight reached
 // after in_seconds seconds. A higher weight means less sound filtered. Weight
 // needs to be between 0 and 1. Unset by setting weight to 1.
-void Channel::set_highpass(f32 weight, f32 in_seconds = 1.0);
+void Bus::set_highpass(f32 weight, f32 in_seconds = 1.0);
+
+///*
+// Adds an effect after the built in ones on a channel or bus, the effect
+// has to live as long as the mixer. The audio has to be locked.
+void EffectChain::add(Effect *effect);
 
 #endif
 
@@ -0,0 +1,227 @@
+namespace Mixer {
+
+bool write_wav(const char *path, const f32 *frames, u32 num_frames) {
+    struct {
+        char riff[4] = {'R', 'I', 'F', 'F'};
+        u32 size;
+        char wave[4] = {'W', 'A', 'V', 'E'};
+        char fmt[4] = {'f', 'm', 't', ' '};
+        u32 fmt_size = 16;
+        u16 format = 3;  // IEEE float
+        u16 channels = 2;
+        u32 sample_rate = AUDIO_SAMPLE_RATE;
+        u32 byte_rate = AUDIO_SAMPLE_RATE * 2 * sizeof(f32);
+        u16 block_align = 2 * sizeof(f32);
+        u16 bitdepth = 32;
+        char data[4] = {'d', 'a', 't', 'a'};
+        u32 data_size;
+    } header;
+    header.data_size = num_frames * 2 * sizeof(f32);
+    header.size = sizeof(header) - 8 + header.data_size;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        ERR("Failed to open \"%s\"", path);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(frames, sizeof(f32) * 2, num_frames, file) == num_frames;
+    fclose(file);
+    if (!written)
+        ERR("Failed to write \"%s\"", path);
+    return written;
+}
+
+// Long enough for the sounds to overlap and the effects to
+// fade in and out.
+static constexpr u32 BENCHMARK_CALLBACKS = 240;
+static constexpr u32 BENCHMARK_FRAMES = BENCHMARK_CALLBACKS * AUDIO_SAMPLES_WANT;
+static constexpr u32 BENCHMARK_RUNS = 5;
+static constexpr u32 BENCHMARK_MAX_SOUNDS = 16;
+
+// Stops every sound and clears the channels, so each run of
+// the script starts from silence.
+static void reset_offline() {
+    while (audio_struct.num_active_sources)
+        remove_source(&audio_struct, audio_struct.active_sources[0]);
+    reset_free_lists(&audio_struct);
+
+    for (u32 i = 0; i < NUM_CHANNELS; i++) {
+        audio_struct.channels[i].effects.reset();
+        audio_struct.channels[i].parent = MASTER_BUS;
+    }
+    for (u32 i = 0; i < NUM_BUSES; i++) {
+        audio_struct.buses[i].effects.reset();
+        audio_struct.buses[i].parent = MASTER_BUS;
+    }
+    audio_struct.sample_index = 0;
+    set_listener(V2(0, 0));
+}
+
+// The events of the script that happen before "callback" is mixed.
+static void benchmark_events(u32 callback, const AssetID *sounds, u32 num_sounds,
+                             AssetID streamed, AudioID *loops) {
+    if (callback == 0) {
+        // The positional sounds go through a bus of their own, and
+        // the others through a bus that's sent to it.
+        for (u32 channel = 1; channel <= 3; channel++)
+            route_channel(channel, 2);
+        for (u32 channel = 4; channel <= 6; channel++)
+            route_channel(channel, 1);
+        route_bus(2, 1);
+        loops[0] = play_sound(0, sounds[0], 1.0, 0.1, 0.0, 0.0, true);
+        if (streamed != Asset::ASSET_ID_NO_ASSET)
+            loops[1] = play_sound(0, streamed, 0.9, 0.1, 0.0, 0.0, true);
+    }
+    if (callback == 180) {
+        stop_sound(loops[0]);
+        if (streamed != Asset::ASSET_ID_NO_ASSET)
+            stop_sound(loops[1]);
+    }
+
+    // More sounds than there are voices, so some of them
+    // are virtual.
+    if (callback % 2 == 0) {
+        u32 i = callback / 2;
+        play_sound(1 + i % 3, sounds[i % num_sounds], 0.75 + 0.05 * (i % 10),
+                   0.2, 0.0, 0.0);
+    }
+    if (callback % 5 == 0) {
+        u32 i = callback / 5;
+        f32 angle = i * 0.7;
+        Vec2 position = V2(cos(angle), sin(angle)) * (1.0 + i % 4);
+        play_sound_at(4 + i % 3, sounds[(i * 7) % num_sounds], position,
+                      1.1 - 0.03 * (i % 8), 0.3, 0.0, 0.0);
+    }
+
+    if (callback == 50) fetch_channel(1)->set_delay(0.4, 0.25, 0.5);
+    if (callback == 100) fetch_channel(2)->set_lowpass(0.2, 1.0);
+    if (callback == 120) fetch_bus(1)->set_lowpass(0.4, 0.5);
+    if (callback == 150) fetch_channel(4)->set_highpass(0.3, 0.5);
+    if (callback == 200) {
+        fetch_bus(1)->set_lowpass(1.0, 0.5);
+        fetch_channel(1)->set_delay(0.0, 0.0, 0.5);
+        fetch_channel(2)->set_lowpass(1.0, 0.5);
+        fetch_channel(4)->set_highpass(1.0, 0.5);
+    }
+
+    // The listener walks around in a circle.
+    f32 time = (f32) callback * AUDIO_SAMPLES_WANT / AUDIO_SAMPLE_RATE;
+    set_listener(V2(cos(time), sin(time)) * 2.0);
+}
+
+// Plays a sound left of where the camera looks, and one right of it,
+// each should come out louder on its own side.
+static bool check_panning(AssetID sound) {
+    Renderer::Camera saved = *Renderer::get_camera();
+    Renderer::get_camera()->position = -V2(10, 0);
+    bool passed = true;
+    for (f32 side = -1; side <= 1; side += 2) {
+        reset_offline();
+        listen_from_camera();
+        play_sound_at(4, sound, V2(10 + side * 3, 0), 1.0, 1.0, 0.0, 0.0);
+        const u32 CALLBACKS = 20;
+        f32 *frames = Util::request_temporary_memory<f32>(AUDIO_SAMPLES_WANT * 2);
+        f64 left = 0;
+        f64 right = 0;
+        for (u32 callback = 0; callback < CALLBACKS; callback++) {
+            render_offline(frames, AUDIO_SAMPLES_WANT);
+            for (u32 i = 0; i < AUDIO_SAMPLES_WANT; i++) {
+                left += ABS(frames[i * 2 + 0]);
+                right += ABS(frames[i * 2 + 1]);
+            }
+        }
+        if (side < 0 ? left <= right : right <= left) {
+            ERR("A sound %s of the camera isn't louder on that side (%f left, %f right)",
+                side < 0 ? "left" : "right", left, right);
+            passed = false;
+        }
+    }
+    *Renderer::get_camera() = saved;
+    reset_offline();
+    return passed;
+}
+
+static u64 checksum(const f32 *samples, u64 num_samples) {
+    // FNV-1a
+    u64 hash = 0xCBF29CE484222325;
+    const u8 *bytes = (const u8 *) samples;
+    for (u64 i = 0; i < num_samples * sizeof(f32); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+bool run_benchmark(const char *wav_path, u64 expected_checksum) {
+    ASSERT(audio_struct.offline, "The benchmark needs an offline mixer");
+    AssetID sounds[BENCHMARK_MAX_SOUNDS];
+    u32 num_sounds = 0;
+    AssetID streamed = Asset::ASSET_ID_NO_ASSET;
+    for (AssetID id = 0; id < Asset::system.file_header.number_of_assets; id++) {
+        if (Asset::system.headers[id].type != Asset::Type::SOUND) continue;
+        if (Asset::is_streamed(id)) {
+            if (streamed == Asset::ASSET_ID_NO_ASSET) streamed = id;
+        } else if (num_sounds < BENCHMARK_MAX_SOUNDS) {
+            sounds[num_sounds++] = id;
+        }
+    }
+    if (!num_sounds) {
+        ERR("There are no sounds to play in the benchmark");
+        return false;
+    }
+
+    Util::allow_allocation();
+    f32 *output = Util::push_memory<f32>(BENCHMARK_FRAMES * 2);
+    u64 first_checksum = 0;
+    f64 best_time = 0.0;
+    f64 sources_time = Perf::clocks[Perf::AUDIO_SOURCES].total_time;
+    f64 effects_time = Perf::clocks[Perf::AUDIO_EFFECTS].total_time;
+    bool deterministic = true;
+    for (u32 run = 0; run < BENCHMARK_RUNS; run++) {
+        reset_offline();
+        AudioID loops[2] = {};
+        u64 start = Perf::highp_now();
+        for (u32 callback = 0; callback < BENCHMARK_CALLBACKS; callback++) {
+            benchmark_events(callback, sounds, num_sounds, streamed, loops);
+            render_offline(output + callback * AUDIO_SAMPLES_WANT * 2, AUDIO_SAMPLES_WANT);
+        }
+        f64 time = (Perf::highp_now() - start) / 1000000.0;
+        best_time = run == 0 ? time : MIN(best_time, time);
+
+        u64 sum = checksum(output, BENCHMARK_FRAMES * 2);
+        if (run == 0)
+            first_checksum = sum;
+        else
+            deterministic &= sum == first_checksum;
+    }
+    reset_offline();
+    sources_time = Perf::clocks[Perf::AUDIO_SOURCES].total_time - sources_time;
+    effects_time = Perf::clocks[Perf::AUDIO_EFFECTS].total_time - effects_time;
+
+    f64 audio_time = (f64) BENCHMARK_FRAMES / AUDIO_SAMPLE_RATE;
+    printf("Mixed %.1f s of audio with %u sounds%s, best of %u runs:\n",
+           audio_time, num_sounds, streamed != Asset::ASSET_ID_NO_ASSET ? " and a stream" : "",
+           BENCHMARK_RUNS);
+    printf("  %.2f ms, %.0f samples/s, %.0fx real time\n", best_time * 1000.0,
+           BENCHMARK_FRAMES * 2 / best_time, audio_time / best_time);
+    printf("  %.3f ms sources, %.3f ms effects per callback\n",
+           sources_time / (BENCHMARK_RUNS * BENCHMARK_CALLBACKS),
+           effects_time / (BENCHMARK_RUNS * BENCHMARK_CALLBACKS));
+    printf("  checksum %016llx\n", (unsigned long long) first_checksum);
+
+    bool passed = deterministic && check_panning(sounds[0]);
+    if (!deterministic)
+        ERR("The runs of the benchmark mixed different sounds");
+    if (expected_checksum && expected_checksum != first_checksum) {
+        ERR("The checksum doesn't match, expected %016llx",
+            (unsigned long long) expected_checksum);
+        passed = false;
+    }
+    if (wav_path)
+        passed &= write_wav(wav_path, output, BENCHMARK_FRAMES);
+    Util::pop_memory(output);
+    return passed;
+}
+
+}  // namespace Mixer
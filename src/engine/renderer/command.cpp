@@ -20,8 +20,14 @@ bool init(const char *title, int width, int height) {
     return Impl::init(title, width, height);
 }
 
-// TODO(ed): Make this into a queue ordeal, so the implementation
-// can live on a separate thread.
+bool init_offscreen(int width, int height) {
+    return Impl::init_offscreen(width, height);
+}
+
+void read_pixels(u8 *pixels) { Impl::read_pixels(pixels); }
+
+// The push calls only write to memory, OpenGL is only called
+// from "blit" on the main thread, since that's where the context is.
 //
 // TODO(ed): Make a static push call so only the moving geometry
 // has to be pushed.
@@ -70,24 +76,19 @@ void push_sprite(u32 layer, s32 slot, Vec2 position, Vec2 dimension, f32 angle,
     right *= dimension.x * 0.5;
     up *= dimension.y * 0.5;
 
-    struct {
-        Vec2 p;
-        Vec2 uv;
-    } coords[] = {
-        {position - right - up, uv_min},
-        {position + right - up, V2(uv_max.x, uv_min.y)},
-        {position + right + up, uv_max},
-        {position - right + up, V2(uv_min.x, uv_max.y)},
+    Vec2 points[] = {
+        position - right - up,
+        position + right - up,
+        position + right + up,
+        position - right + up,
     };
-
-    Impl::push_triangle(layer,
-                        coords[0].p, coords[1].p, coords[2].p,
-                        coords[0].uv, coords[1].uv, coords[2].uv, color, color,
-                        color, slot);
-    Impl::push_triangle(layer,
-                        coords[0].p, coords[2].p, coords[3].p,
-                        coords[0].uv, coords[2].uv, coords[3].uv, color, color,
-                        color, slot);
+    Vec2 uvs[] = {
+        uv_min,
+        V2(uv_max.x, uv_min.y),
+        uv_max,
+        V2(uv_min.x, uv_max.y),
+    };
+    Impl::push_quad(layer, points, uvs, slot, color);
 }
 
 void push_sprite(u32 layer, Vec2 position, Vec2 dimension, f32 angle,
@@ -107,6 +108,13 @@ void push_sdf_quad(Vec2 min, Vec2 max, Vec2 min_uv, Vec2 max_uv, int sprite,
                         border);
 }
 
+void push_sdf_quads(u32 num_quads, const SdfQuad *quads, Vec2 offset,
+                    f32 scale, int sprite, Vec4 color, f32 low, f32 high,
+                    bool border) {
+    Impl::push_sdf_quads(num_quads, quads, offset, scale, sprite, color, low,
+                         high, border);
+}
+
 // Upload a texture to a specific slot on the GPU.
 u32 upload_texture(Image image, s32 index) {
     return Impl::upload_texture(&image, index);
@@ -123,6 +131,25 @@ void upload_shader(AssetID asset, char *source) {
 // Draw all rendered pixels to the screen.
 void blit() { Impl::blit(); }
 
+void parallel_draw(u32 count, u32 chunk_size, Util::RangeFunc f) {
+    ASSERT(Util::on_main_thread(), "Can only be called from the main thread");
+    ASSERT(chunk_size, "Chunk size has to be larger than zero");
+    u32 num_chunks = (count + chunk_size - 1) / chunk_size;
+    u32 first_order = Impl::next_draw_order;
+    Impl::next_draw_order += num_chunks + 1;
+    Util::parallel_for(count, chunk_size, [first_order, chunk_size, f](u32 begin, u32 end) {
+        // The main thread helps out, so it has to get its order back.
+        u32 old_order = Impl::draw_order;
+        Impl::draw_order = first_order + begin / chunk_size;
+        f(begin, end);
+        Impl::draw_order = old_order;
+    });
+    // Anything drawn after this goes on top.
+    Impl::draw_order = first_order + num_chunks;
+}
+
+Stats get_stats() { return Impl::last_frame_stats; }
+
 void set_window_position(int x, int y) { Impl::set_window_position(x, y); }
 
 Vec2 get_window_position() { return Impl::get_window_position(); }
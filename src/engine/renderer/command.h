@@ -12,6 +12,15 @@ namespace Renderer {
 // Initalize the graphics context.
 bool init(const char *title, int width, int height);
 
+// Initalize the graphics context without a window, "blit" then
+// draws to memory that "read_pixels" can copy out. Works with a
+// software renderer, so nothing has to be shown.
+bool init_offscreen(int width, int height);
+
+// Copies the last frame drawn offscreen to "pixels", which has room
+// for width * height RGB pixels. The bottom row comes first.
+void read_pixels(u8 *pixels);
+
 // Clear the screen and prepare for rendering.
 void clear();
 
@@ -26,6 +35,18 @@ void push_quad(u32 layer, Vec2 min, Vec2 max, Vec4 color = V4(1, 1, 1, 1));
 void push_sdf_quad(Vec2 min, Vec2 max, Vec2 min_uv, Vec2 max_uv, int sprite,
                    Vec4 color, f32 low, f32 high, bool border = false);
 
+// One of the quads in a run of SDF quads.
+struct SdfQuad {
+    Vec2 min, max;
+    Vec2 min_uv, max_uv;
+};
+
+// Pushes a run of SDF quads that share everything but the corners,
+// the corners are scaled by "scale" and then moved by "offset".
+void push_sdf_quads(u32 num_quads, const SdfQuad *quads, Vec2 offset,
+                    f32 scale, int sprite, Vec4 color, f32 low, f32 high,
+                    bool border = false);
+
 ///*
 // Renders a rotated sprite to the screen. The position is the center if the
 // sprite and dimension is the total width of the sprite, both are given in
@@ -33,7 +54,8 @@ void push_sdf_quad(Vec2 min, Vec2 max, Vec2 min_uv, Vec2 max_uv, int sprite,
 // pixel-coordinates of the texture. The color can be used to tint the sprite
 // by a simple multiply. The texture supplied has to be a loaded texture asset.
 // Angle is given in radians and is the rotation around the center point
-// of the sprite.
+// of the sprite. The texture is fetched, so this can't be called from
+// the workers in "parallel_draw".
 void push_sprite(u32 layer, Vec2 position, Vec2 dimension, f32 angle,
                  AssetID texture, Vec2 uv_min, Vec2 uv_dimension,
                  Vec4 color = V4(1, 1, 1, 1));
@@ -116,6 +138,39 @@ bool is_fullscreen();
 // Draw all rendered pixels to the screen.
 void blit();
 
+///*
+// Calls "f" on chunks of [0, count) on all the worker threads, like
+// "Util::parallel_for", so many things can be pushed at once. What's
+// pushed ends up in the same order as if the chunks were called one
+// after the other, and before what's pushed after this call.
+//
+// The assets have to be fetched before, since fetching them can upload
+// them to the GPU, and that has to happen on the main thread.
+void parallel_draw(u32 count, u32 chunk_size, Util::RangeFunc f);
+
+///*
+// What the renderer did the last time "blit" was called, handy
+// when looking for what makes a frame slow to draw.
+struct Stats {
+    // Calls to OpenGL that draw something.
+    u32 draw_calls;
+    // Verticies pushed during the frame.
+    u32 verticies;
+    // Vertex data sent to the GPU.
+    u64 uploaded_bytes;
+};
+
+///*
+// Returns the stats from the last frame.
+Stats get_stats();
+
+// Draws a few scenes offscreen and prints how long the frames took and
+// the stats of the last one. If "golden_dir" is set, the last frame of
+// each scene is checked against the image with the scene's name in that
+// directory, and the image is recorded if it's missing. Returns false if
+// an image doesn't match.
+bool run_benchmark(const char *golden_dir);
+
 }  // namespace Renderer
 
 #ifdef _EXAMPLES_
@@ -2,3 +2,4 @@
 
 #include <glad/glad.h>
 #include <glad/glad.c>
+#include <algorithm>
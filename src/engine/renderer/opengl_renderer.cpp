@@ -3,7 +3,6 @@ const static int GLSL_GLOBAL_BLOCK = 0;
 const static u32 ubo_int_size    = sizeof(u32);
 const static u32 ubo_global_size = sizeof(_fog_global_window_state);
 static GLuint ubo_global;
-static int _fog_texture_indicies[OPENGL_NUM_CAMERAS];
 
 static Program compile_shader_program_from_source(const char *source) {
 #define SHADER_ERROR_CHECK(SHDR)                             \
@@ -44,7 +43,9 @@ static Program compile_shader_program_from_source(const char *source) {
         "   Camera cam[" STR(OPENGL_NUM_CAMERAS) "];\n"
         "   Window win;\n"
         "};\n"
-        "uniform uint current_cam;\n"
+        "uniform uint num_views;\n"
+        "uniform uint view_cams[" STR(OPENGL_NUM_CAMERAS) "];\n"
+        "const uint INVALID_SPRITE = " STR(OPENGL_INVALID_SPRITE) "u;\n"
         ,
         source};
     glShaderSource(vert, LEN(complete_source), complete_source, NULL);
@@ -79,84 +80,206 @@ static Program compile_shader_program_from_source(const char *source) {
     return shader;
 }
 
+static u16 pack_unorm16(f32 value) {
+    return (u16) (CLAMP(0.0f, 1.0f, value) * 0xFFFF + 0.5f);
+}
+
+static u8 pack_unorm8(f32 value) {
+    return (u8) (CLAMP(0.0f, 1.0f, value) * 0xFF + 0.5f);
+}
+
+static u16 pack_sprite(s32 sprite) {
+    ASSERT(sprite <= OPENGL_INVALID_SPRITE, "Sprite index out of range.");
+    return sprite < 0 ? OPENGL_INVALID_SPRITE : (u16) sprite;
+}
+
+Vertex Vertex::pack(Vec2 position, Vec2 texture, s32 sprite, Vec4 color) {
+    Vertex vertex;
+    vertex.position = position;
+    vertex.texture[0] = pack_unorm16(texture.x);
+    vertex.texture[1] = pack_unorm16(texture.y);
+    for (u32 i = 0; i < 4; i++)
+        vertex.color[i] = pack_unorm8(color._[i]);
+    vertex.sprite = pack_sprite(sprite);
+    vertex.padding = 0;
+    return vertex;
+}
+
+SdfVertex SdfVertex::pack(Vec2 position, Vec2 texture, s32 sprite, Vec4 color,
+                          f32 low, f32 high, bool border) {
+    SdfVertex vertex;
+    vertex.position = position;
+    vertex.texture[0] = pack_unorm16(texture.x);
+    vertex.texture[1] = pack_unorm16(texture.y);
+    for (u32 i = 0; i < 4; i++)
+        vertex.color[i] = pack_unorm8(color._[i]);
+    vertex.sprite = pack_sprite(sprite);
+    vertex.border = border;
+    vertex.low = pack_unorm16(low);
+    vertex.high = pack_unorm16(high);
+    return vertex;
+}
+
 template <typename T>
 u32 RenderQueue<T>::total_number_of_verticies() const {
     u32 sum = 0;
-    for (u32 i = 0; i < num_buffers; i++) {
-        sum += vertex_buffers[i].draw_length;
+    for (u32 i = 0; i < NUM_THREADS * num_layers; i++) {
+        sum += layers[i].length;
     }
     return sum;
 }
 
 template <typename T>
-void RenderQueue<T>::create(u32 triangels_per_buffer) {
+void RenderQueue<T>::create(u32 num_layers, u32 quads_per_layer) {
     ASSERT(gl_draw_hint == 0,
            "Cannot create same RenderQueue twice without deleteing.");
-    buffer_size = triangels_per_buffer * 3;
-    arena = Util::request_arena(true);
-    vertex_buffers = arena->push<GLBuffer>(num_buffers);
+    this->num_layers = num_layers;
+    layers = Util::push_memory<Layer>(NUM_THREADS * num_layers);
+    for (u32 i = 0; i < NUM_THREADS * num_layers; i++) {
+        Layer *layer = layers + i;
+        *layer = {};
+        if (i < num_layers) {
+            layer->capacity = quads_per_layer * 4;
+            layer->verticies = Util::push_memory<T>(layer->capacity);
+            layer->max_segments = 1;
+            layer->segments = Util::push_memory<Segment>(layer->max_segments);
+        }
+    }
+
+    num_draws = 0;
+    max_draws = 1;
+    draw_counts = Util::push_memory<GLsizei>(max_draws);
+    draw_first_verticies = Util::push_memory<GLint>(max_draws);
 
     gl_draw_hint = GL_TRIANGLES;
+    gl_capacity = num_layers * quads_per_layer * 4;
+    glGenVertexArrays(1, &gl_array_object);
+    glGenBuffers(1, &gl_buffer);
+    glBindVertexArray(gl_array_object);
+    glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+    glBufferData(GL_ARRAY_BUFFER, gl_capacity * sizeof(T), NULL,
+                 GL_STREAM_DRAW);
+    enable_attrib_pointer();
+    glBindVertexArray(0);
+}
 
-    next_free = 0;
-    num_buffers = 0;
-    expand();
+// Makes room for "length" elements in "data", doubling the
+// capacity.
+template <typename E>
+static void reserve(E **data, u32 *capacity, u32 length) {
+    if (length <= *capacity) return;
+    u32 new_capacity = MAX(*capacity, 4u);
+    while (new_capacity < length)
+        new_capacity *= 2;
+    std::lock_guard<std::mutex> guard(grow_lock);
+    Util::allow_allocation();
+    *data = Util::resize_memory(*data, new_capacity);
+    *capacity = new_capacity;
 }
 
 template <typename T>
-void RenderQueue<T>::push(u32 num_new_verticies, T *new_verticies) {
+void RenderQueue<T>::push(u32 layer, u32 num_new_verticies, T *new_verticies) {
     ASSERT(gl_draw_hint, "Trying to use uninitalized render queue.");
-    ASSERT(gl_draw_hint == GL_TRIANGLES, "Push code assumes triangles.");
-
-    while (num_new_verticies) {
-        for (u32 i = next_free; num_new_verticies; i++) {
-            next_free = i;
-            if (next_free == num_buffers) expand();
-            GLBuffer *buffer = vertex_buffers + next_free;
-            u32 free = buffer_size - buffer->draw_length;
-            if (free == 0) continue;
-            u32 to_push = MIN(num_new_verticies, (u32) free);
-
-            buffer->bind();
-            glBufferSubData(GL_ARRAY_BUFFER,
-                            buffer->draw_length * sizeof(T),
-                            to_push * sizeof(T), new_verticies);
-
-            buffer->draw_length += to_push;
-            num_new_verticies -= to_push;
-            new_verticies += to_push;
-        }
+    ASSERT(layer < num_layers, "Invalid layer.");
+    ASSERT(num_new_verticies % 4 == 0, "Only whole quads can be pushed.");
+    Layer *target = layers + Util::worker_id() * num_layers + layer;
+    u32 length = target->length + num_new_verticies;
+    reserve(&target->verticies, &target->capacity, length);
+    Util::copy_bytes(new_verticies, target->verticies + target->length,
+                     num_new_verticies * sizeof(T));
+
+    u32 num_segments = target->num_segments;
+    if (num_segments && target->segments[num_segments - 1].order == draw_order) {
+        target->segments[num_segments - 1].length += num_new_verticies;
+    } else {
+        reserve(&target->segments, &target->max_segments,
+                target->num_segments + 1);
+        target->segments[target->num_segments++] = {draw_order, target->length,
+                                                    num_new_verticies};
     }
-    glBindVertexArray(0);
+    target->length = length;
 }
 
-
 template <typename T>
-void RenderQueue<T>::expand() {
+u32 RenderQueue<T>::upload() {
     ASSERT(gl_draw_hint, "Trying to use uninitalized render queue");
-    arena->clear();
-    u32 to_copy = num_buffers;
-    num_buffers += GROW_BY;
-    GLBuffer *new_buffers = arena->push<GLBuffer>(num_buffers);
-    if (new_buffers != vertex_buffers) {
-        for (u32 i = 0; i < to_copy; i++) {
-            new_buffers[i] = vertex_buffers[i];
-        }
-        vertex_buffers = new_buffers;
+    num_draws = 0;
+    u32 total = total_number_of_verticies();
+    if (total == 0) return 0;
+
+    const u32 max_draw_length = OPENGL_MAX_QUADS_PER_DRAW * 4;
+    u32 needed_draws = (total + max_draw_length - 1) / max_draw_length;
+    if (max_draws < needed_draws) {
+        max_draws = needed_draws;
+        Util::allow_allocation();
+        draw_counts = Util::resize_memory(draw_counts, max_draws);
+        Util::allow_allocation();
+        draw_first_verticies = Util::resize_memory(draw_first_verticies, max_draws);
+    }
+    u32 max_layer_segments = 0;
+    for (u32 i = 0; i < num_layers; i++) {
+        u32 num_segments = 0;
+        for (u32 t = 0; t < NUM_THREADS; t++)
+            num_segments += layers[t * num_layers + i].num_segments;
+        max_layer_segments = MAX(max_layer_segments, num_segments);
     }
 
-    u32 vaos[GROW_BY];
-    glGenVertexArrays(GROW_BY, vaos);
-    u32 buffers[GROW_BY];
-    glGenBuffers(GROW_BY, buffers);
-    for (u32 i = 0; i < GROW_BY; i++) {
-        vertex_buffers[to_copy + i] = {0, buffers[i], vaos[i]};
-        vertex_buffers[to_copy + i].bind();
-        glBufferData(GL_ARRAY_BUFFER, buffer_size * sizeof(T), NULL,
+    glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
+    if (gl_capacity < total) {
+        while (gl_capacity < total)
+            gl_capacity *= 2;
+        glBufferData(GL_ARRAY_BUFFER, gl_capacity * sizeof(T), NULL,
                      GL_STREAM_DRAW);
-        enable_attrib_pointer();
     }
-    glBindVertexArray(0);
+    // The old contents are thrown away, so the driver doesn't have
+    // to wait for the last frame to finish drawing.
+    T *mapped = (T *) glMapBufferRange(GL_ARRAY_BUFFER, 0, total * sizeof(T),
+                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    ASSERT(mapped, "Failed to map vertex buffer");
+
+    struct Source {
+        u32 order;
+        u32 thread;
+        const T *verticies;
+        u32 length;
+    };
+    Source *sources = Util::request_temporary_memory<Source>(max_layer_segments);
+    u32 first = 0;
+    for (u32 i = 0; i < num_layers; i++) {
+        u32 num_sources = 0;
+        for (u32 t = 0; t < NUM_THREADS; t++) {
+            Layer *layer = layers + t * num_layers + i;
+            for (u32 s = 0; s < layer->num_segments; s++) {
+                Segment segment = layer->segments[s];
+                sources[num_sources++] = {segment.order, t,
+                                          layer->verticies + segment.first,
+                                          segment.length};
+            }
+        }
+        // Jobs that push outside of "parallel_draw" all have order
+        // zero, they're put in the order of the threads.
+        std::sort(sources, sources + num_sources,
+                  [](const Source &a, const Source &b) {
+                      if (a.order != b.order) return a.order < b.order;
+                      return a.thread < b.thread;
+                  });
+
+        for (u32 s = 0; s < num_sources; s++) {
+            Util::copy_bytes((void *) sources[s].verticies, mapped + first,
+                             sources[s].length * sizeof(T));
+            first += sources[s].length;
+        }
+    }
+    for (u32 done = 0; done < total; done += max_draw_length) {
+        u32 length = MIN(total - done, max_draw_length);
+        draw_counts[num_draws] = length / 4 * 6;
+        draw_first_verticies[num_draws] = done;
+        num_draws++;
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return total * sizeof(T);
 }
 
 template <>
@@ -168,11 +291,11 @@ void RenderQueue<Vertex>::enable_attrib_pointer() {
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                           (void *) offsetof(Vertex, position));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Vertex),
                           (void *) offsetof(Vertex, texture));
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *) offsetof(Vertex, sprite));
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_SHORT, sizeof(Vertex),
+                           (void *) offsetof(Vertex, sprite));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex),
                           (void *) offsetof(Vertex, color));
 }
 
@@ -188,101 +311,100 @@ void RenderQueue<SdfVertex>::enable_attrib_pointer() {
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
                           (void *) offsetof(SdfVertex, position));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
+    glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SdfVertex),
                           (void *) offsetof(SdfVertex, texture));
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
-                          (void *) offsetof(SdfVertex, sprite));
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_SHORT, sizeof(SdfVertex),
+                           (void *) offsetof(SdfVertex, sprite));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SdfVertex),
                           (void *) offsetof(SdfVertex, color));
-    glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
+    glVertexAttribPointer(4, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SdfVertex),
                           (void *) offsetof(SdfVertex, low));
-    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(SdfVertex),
+    glVertexAttribPointer(5, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SdfVertex),
                           (void *) offsetof(SdfVertex, high));
-    glVertexAttribPointer(6, 1, GL_INT, GL_FALSE, sizeof(SdfVertex),
-                          (void *) offsetof(SdfVertex, border));
+    glVertexAttribIPointer(6, 1, GL_UNSIGNED_SHORT, sizeof(SdfVertex),
+                           (void *) offsetof(SdfVertex, border));
 }
 
 template <typename T>
-void RenderQueue<T>::draw() const {
+void RenderQueue<T>::draw(u32 instances) const {
     ASSERT(gl_draw_hint, "Trying to use uninitalized render queue");
-    for (u32 i = 0; i < num_buffers; i++) {
-        GLBuffer buffer = vertex_buffers[i];
-        if (buffer.draw_length == 0) break;
-        buffer.bind();
-        glBindBuffer(GL_ARRAY_BUFFER, buffer.gl_buffer);
-        glDrawArrays(gl_draw_hint, 0, buffer.draw_length);
+    if (num_draws == 0 || instances == 0) return;
+    glBindVertexArray(gl_array_object);
+    for (u32 i = 0; i < num_draws; i++) {
+        glDrawElementsInstancedBaseVertex(gl_draw_hint, draw_counts[i],
+                                          GL_UNSIGNED_SHORT, 0, instances,
+                                          draw_first_verticies[i]);
+        frame_stats.draw_calls++;
     }
     glBindVertexArray(0);
 }
 
 template <typename T>
 void RenderQueue<T>::clear() {
-    next_free = 0;
-    for (u32 i = 0; i < num_buffers; i++) vertex_buffers[i].draw_length = 0;
+    for (u32 i = 0; i < NUM_THREADS * num_layers; i++) {
+        layers[i].length = 0;
+        layers[i].num_segments = 0;
+    }
 }
 
 template <typename T>
 void RenderQueue<T>::destroy() {
-    next_free = 0;
-    u32 *buffers = arena->push<u32>(num_buffers);
-    for (u32 i = 0; i < num_buffers; i++)
-        buffers[i] = vertex_buffers[i].gl_buffer;
+    for (u32 i = 0; i < NUM_THREADS * num_layers; i++) {
+        Util::pop_memory(layers[i].verticies);
+        Util::pop_memory(layers[i].segments);
+    }
+    Util::pop_memory(layers);
+    Util::pop_memory(draw_counts);
+    Util::pop_memory(draw_first_verticies);
     gl_draw_hint = 0;
-    glDeleteBuffers(num_buffers, buffers);
+    glDeleteBuffers(1, &gl_buffer);
+    glDeleteVertexArrays(1, &gl_array_object);
 }
 
 void resize_window(int width, int height) {
     recalculate_global_aspect_ratio(width, height);
     glViewport(0, 0, width, height);
 
-    for (u32 cam = 0; cam < OPENGL_NUM_CAMERAS; cam++) {
-        GLuint rbo = screen_rbos[cam];
-        GLuint texture = screen_textures[cam];
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                GL_UNSIGNED_BYTE, NULL);
-
-        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
-                width, height);
-    }
+    glBindTexture(GL_TEXTURE_2D, screen_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
+            GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, screen_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+            width, height);
     glBindRenderbuffer(GL_RENDERBUFFER, 0);
 }
 
 void create_frame_buffers(int width, int height) {
-    glGenTextures(OPENGL_NUM_CAMERAS, (GLuint *) &screen_textures);
-    glGenFramebuffers(OPENGL_NUM_CAMERAS, (GLuint *) &screen_fbos);
-    glGenRenderbuffers(OPENGL_NUM_CAMERAS, (GLuint *) &screen_rbos);
-    for (u32 cam = 0; cam < OPENGL_NUM_CAMERAS; cam++) {
-        GLuint fbo = screen_fbos[cam];
-        GLuint rbo = screen_rbos[cam];
-        GLuint texture = screen_textures[cam];
-
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                GL_UNSIGNED_BYTE, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glBindTexture(GL_TEXTURE_2D, 0);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-        {
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                    GL_TEXTURE_2D, texture, 0);
-
-            glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-            {
-                glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
-                        width, height);
-            }
-            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenTextures(1, &screen_texture);
+    glGenFramebuffers(1, &screen_fbo);
+    glGenRenderbuffers(1, &screen_rbo);
+
+    glBindTexture(GL_TEXTURE_2D, screen_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
+            GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
 
-            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                    GL_RENDERBUFFER, rbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_fbo);
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                GL_TEXTURE_2D, screen_texture, 0);
 
-            if (glCheckFramebufferStatus(fbo) != GL_FRAMEBUFFER_COMPLETE)
-                ERR("Incomplete framebuffer");
+        glBindRenderbuffer(GL_RENDERBUFFER, screen_rbo);
+        {
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8,
+                    width, height);
         }
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                GL_RENDERBUFFER, screen_rbo);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            ERR("Incomplete framebuffer");
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -314,34 +436,77 @@ void create_frame_buffers(int width, int height) {
     glBindVertexArray(0);
 }
 
-void render_post_processing() {
-    post_process_shader_program.bind();
+void create_output_frame_buffer(int width, int height) {
+    output_width = width;
+    output_height = height;
+    glGenFramebuffers(1, &output_fbo);
+    glGenRenderbuffers(1, &output_rbo);
 
-    // This needs to run every frame
-    {
-        for (u32 i = 0; i < OPENGL_NUM_CAMERAS; i++) {
-            glBindTexture(GL_TEXTURE_2D, screen_textures[i]);
-            glActiveTexture(GL_TEXTURE1 + i);
-        }
+    glBindRenderbuffer(GL_RENDERBUFFER, output_rbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, output_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_RENDERBUFFER, output_rbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        ERR("Incomplete framebuffer");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-        glUniform1iv(screen_texture_location, OPENGL_NUM_CAMERAS, &_fog_texture_indicies[0]);
-        glUniform1i(num_screen_textures_location, _fog_num_active_cameras);
+void read_pixels(u8 *pixels) {
+    ASSERT(offscreen, "Can only read the pixels when rendering offscreen");
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, output_fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, output_width, output_height, GL_RGB, GL_UNSIGNED_BYTE,
+                 pixels);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void create_quad_index_buffer() {
+    u16 *indicies = Util::request_temporary_memory<u16>(OPENGL_MAX_QUADS_PER_DRAW * 6);
+    for (u32 i = 0; i < OPENGL_MAX_QUADS_PER_DRAW; i++) {
+        u16 corner = i * 4;
+        u16 quad[] = {
+            (u16) (corner + 0), (u16) (corner + 1), (u16) (corner + 2),
+            (u16) (corner + 0), (u16) (corner + 2), (u16) (corner + 3),
+        };
+        Util::copy_bytes(quad, indicies + i * 6, sizeof(quad));
     }
+    glGenBuffers(1, &quad_index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 OPENGL_MAX_QUADS_PER_DRAW * 6 * sizeof(u16), indicies,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void render_post_processing() {
+    post_process_shader_program.bind();
+
+    // The sprites stay bound to the first unit.
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, screen_texture);
+    glUniform1i(screen_texture_location, 1);
 
     glBindVertexArray(screen_quad_vao);
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    frame_stats.draw_calls++;
     glBindVertexArray(0);
 
     glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
 }
 
 bool init(const char *title, int width, int height) {
-    if (SDL_Init(SDL_INIT_EVERYTHING)) {
+    // Without a window there's no need for the rest of SDL, and
+    // there might not be an audio device.
+    if (SDL_Init(offscreen ? SDL_INIT_VIDEO : SDL_INIT_EVERYTHING)) {
         ERR("Failed to initalize SDL");
         return false;
     }
     window = SDL_CreateWindow(title, 0, 0, width, height,
-                              SDL_WINDOW_OPENGL);
+                              SDL_WINDOW_OPENGL | (offscreen ? SDL_WINDOW_HIDDEN : 0));
 
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
@@ -362,14 +527,9 @@ bool init(const char *title, int width, int height) {
     glDebugMessageCallback(gl_debug_message, 0);
 #endif
 
-    for (u32 i = 0; i < OPENGL_NUM_LAYERS; i++) {
-        sprite_render_queues[i].create(512);
-    }
-    font_render_queue.create(256);
-
-    // Initalize texture indicies
-    for (u32 i = 0; i < OPENGL_NUM_CAMERAS; i++)
-        _fog_texture_indicies[i] = i;
+    create_quad_index_buffer();
+    sprite_render_queue.create(OPENGL_NUM_LAYERS, 512);
+    font_render_queue.create(1, 256);
 
     glGenBuffers(1, &ubo_global);
     glBindBuffer(GL_UNIFORM_BUFFER, ubo_global);
@@ -378,6 +538,8 @@ bool init(const char *title, int width, int height) {
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
     create_frame_buffers(width, height);
+    if (offscreen)
+        create_output_frame_buffer(width, height);
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -400,66 +562,130 @@ bool init(const char *title, int width, int height) {
     return true;
 }
 
+bool init_offscreen(int width, int height) {
+    offscreen = true;
+    // SDLs offscreen driver makes a context with EGL, so it works
+    // without a display. Another driver can still be picked with
+    // "SDL_VIDEODRIVER".
+    SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+    return init("Offscreen", width, height);
+}
+
 #define LAYER_CHECK(L)                          \
     ASSERT(0 <= (L) && (L) < OPENGL_NUM_LAYERS, \
            "Invalid layer, should be between 0 and OPENGL_NUM_LAYERS");
 void push_verticies(u32 layer, u32 num_verticies, Vertex *verticies) {
     LAYER_CHECK(layer);
-    sprite_render_queues[layer].push(num_verticies, verticies);
+    ASSERT(num_verticies % 3 == 0, "Verticies should form triangles.");
+    // The queues only take quads, so each triangle gets its last
+    // corner twice. It's done in batches on the stack, since this
+    // can be called from any thread.
+    const u32 BATCH = 64;
+    Vertex corners[BATCH * 4];
+    for (u32 done = 0; done < num_verticies / 3; done += BATCH) {
+        u32 num_triangles = MIN(num_verticies / 3 - done, BATCH);
+        for (u32 i = 0; i < num_triangles; i++) {
+            Vertex *triangle = verticies + (done + i) * 3;
+            corners[i * 4 + 0] = triangle[0];
+            corners[i * 4 + 1] = triangle[1];
+            corners[i * 4 + 2] = triangle[2];
+            corners[i * 4 + 3] = triangle[2];
+        }
+        sprite_render_queue.push(layer, num_triangles * 4, corners);
+    }
 }
 
 void push_sdf_quad(Vec2 min, Vec2 max, Vec2 min_uv, Vec2 max_uv,
-                          f32 sprite, Vec4 color, f32 low, f32 high,
+                          s32 sprite, Vec4 color, f32 low, f32 high,
                           bool border) {
-    SdfVertex verticies[] = {
-        {V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color, low, high,
-         border},
-        {V2(max.x, min.y), V2(max_uv.x, max_uv.y), sprite, color, low, high,
-         border},
-        {V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color, low, high,
-         border},
-
-        {V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color, low, high,
-         border},
-        {V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color, low, high,
-         border},
-        {V2(min.x, max.y), V2(min_uv.x, min_uv.y), sprite, color, low, high,
-         border},
+    SdfVertex corners[] = {
+        SdfVertex::pack(V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color,
+                        low, high, border),
+        SdfVertex::pack(V2(max.x, min.y), V2(max_uv.x, max_uv.y), sprite, color,
+                        low, high, border),
+        SdfVertex::pack(V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color,
+                        low, high, border),
+        SdfVertex::pack(V2(min.x, max.y), V2(min_uv.x, min_uv.y), sprite, color,
+                        low, high, border),
     };
-    font_render_queue.push(LEN(verticies), verticies);
+    font_render_queue.push(0, LEN(corners), corners);
+}
+
+void push_sdf_quads(u32 num_quads, const SdfQuad *quads, Vec2 offset,
+                    f32 scale, s32 sprite, Vec4 color, f32 low, f32 high,
+                    bool border) {
+    // Only the corners differ, so the rest is packed once.
+    SdfVertex vertex = SdfVertex::pack(V2(0, 0), V2(0, 0), sprite, color,
+                                       low, high, border);
+    const u32 BATCH = 64;
+    SdfVertex corners[BATCH * 4];
+    for (u32 first = 0; first < num_quads; first += BATCH) {
+        u32 num_in_batch = MIN(BATCH, num_quads - first);
+        for (u32 i = 0; i < num_in_batch; i++) {
+            const SdfQuad *quad = quads + first + i;
+            Vec2 min = quad->min * scale + offset;
+            Vec2 max = quad->max * scale + offset;
+            Vec2 positions[] = {
+                V2(min.x, min.y), V2(max.x, min.y),
+                V2(max.x, max.y), V2(min.x, max.y),
+            };
+            Vec2 uvs[] = {
+                V2(quad->min_uv.x, quad->max_uv.y), V2(quad->max_uv.x, quad->max_uv.y),
+                V2(quad->max_uv.x, quad->min_uv.y), V2(quad->min_uv.x, quad->min_uv.y),
+            };
+            for (u32 c = 0; c < 4; c++) {
+                SdfVertex *corner = corners + i * 4 + c;
+                *corner = vertex;
+                corner->position = positions[c];
+                corner->texture[0] = pack_unorm16(uvs[c].x);
+                corner->texture[1] = pack_unorm16(uvs[c].y);
+            }
+        }
+        font_render_queue.push(0, num_in_batch * 4, corners);
+    }
 }
 
 void push_quad(u32 layer, Vec2 min, Vec2 min_uv, Vec2 max, Vec2 max_uv,
-                      f32 sprite, Vec4 color) {
+                      s32 sprite, Vec4 color) {
     LAYER_CHECK(layer);
-    Vertex verticies[] = {
-        {V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color},
-        {V2(max.x, min.y), V2(max_uv.x, max_uv.y), sprite, color},
-        {V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color},
-
-        {V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color},
-        {V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color},
-        {V2(min.x, max.y), V2(min_uv.x, min_uv.y), sprite, color},
+    Vertex corners[] = {
+        Vertex::pack(V2(min.x, min.y), V2(min_uv.x, max_uv.y), sprite, color),
+        Vertex::pack(V2(max.x, min.y), V2(max_uv.x, max_uv.y), sprite, color),
+        Vertex::pack(V2(max.x, max.y), V2(max_uv.x, min_uv.y), sprite, color),
+        Vertex::pack(V2(min.x, max.y), V2(min_uv.x, min_uv.y), sprite, color),
     };
-    sprite_render_queues[layer].push(LEN(verticies), verticies);
+    sprite_render_queue.push(layer, LEN(corners), corners);
+}
+
+void push_quad(u32 layer, const Vec2 *points, const Vec2 *uvs, s32 sprite,
+               Vec4 color) {
+    LAYER_CHECK(layer);
+    Vertex corners[] = {
+        Vertex::pack(points[0], uvs[0], sprite, color),
+        Vertex::pack(points[1], uvs[1], sprite, color),
+        Vertex::pack(points[2], uvs[2], sprite, color),
+        Vertex::pack(points[3], uvs[3], sprite, color),
+    };
+    sprite_render_queue.push(layer, LEN(corners), corners);
 }
 
 void push_quad(u32 layer, Vec2 min, Vec2 max, Vec4 color) {
     LAYER_CHECK(layer);
-    push_quad(layer, min, V2(-1, -1), max, V2(-1, -1), OPENGL_INVALID_SPRITE, color);
+    push_quad(layer, min, V2(0, 0), max, V2(0, 0), OPENGL_INVALID_SPRITE, color);
 }
 
 void push_triangle(u32 layer, Vec2 p1, Vec2 p2, Vec2 p3,
                           Vec2 uv1, Vec2 uv2, Vec2 uv3,
                           Vec4 color1, Vec4 color2, Vec4 color3,
-                          f32 sprite) {
+                          s32 sprite) {
     LAYER_CHECK(layer);
-    Vertex verticies[] = {
-        {p1, uv1, sprite, color1},
-        {p2, uv2, sprite, color2},
-        {p3, uv3, sprite, color3},
+    Vertex corners[] = {
+        Vertex::pack(p1, uv1, sprite, color1),
+        Vertex::pack(p2, uv2, sprite, color2),
+        Vertex::pack(p3, uv3, sprite, color3),
+        Vertex::pack(p3, uv3, sprite, color3),
     };
-    sprite_render_queues[layer].push(LEN(verticies), verticies);
+    sprite_render_queue.push(layer, LEN(corners), corners);
 }
 
 void push_line(u32 layer, Vec2 start, Vec2 end, Vec4 start_color, Vec4 end_color,
@@ -467,16 +693,13 @@ void push_line(u32 layer, Vec2 start, Vec2 end, Vec4 start_color, Vec4 end_color
     LAYER_CHECK(layer);
     Vec2 normal = normalize(rotate_ccw(start - end));
     Vec2 offset = normal * thickness * 0.5;
-    Vertex verticies[] = {
-        {start + offset, V2(0, 0), OPENGL_INVALID_SPRITE, start_color},
-        {start - offset, V2(0, 0), OPENGL_INVALID_SPRITE, start_color},
-        {end - offset, V2(0, 0), OPENGL_INVALID_SPRITE, end_color},
-
-        {start + offset, V2(0, 0), OPENGL_INVALID_SPRITE, start_color},
-        {end - offset, V2(0, 0), OPENGL_INVALID_SPRITE, end_color},
-        {end + offset, V2(0, 0), OPENGL_INVALID_SPRITE, end_color},
+    Vertex corners[] = {
+        Vertex::pack(start + offset, V2(0, 0), OPENGL_INVALID_SPRITE, start_color),
+        Vertex::pack(start - offset, V2(0, 0), OPENGL_INVALID_SPRITE, start_color),
+        Vertex::pack(end - offset, V2(0, 0), OPENGL_INVALID_SPRITE, end_color),
+        Vertex::pack(end + offset, V2(0, 0), OPENGL_INVALID_SPRITE, end_color),
     };
-    sprite_render_queues[layer].push(LEN(verticies), verticies);
+    sprite_render_queue.push(layer, LEN(corners), corners);
 }
 
 void push_point(u32 layer, Vec2 point, Vec4 color, f32 size) {
@@ -526,8 +749,10 @@ void upload_shader(AssetID asset, const char *source) {
         case ASSET_MASTER_SHADER:
             master_shader_program = compile_shader_program_from_source(source);
             ASSERT(master_shader_program, "Failed to compile shader");
-            master_shader_current_cam_loc =
-                glGetUniformLocation(master_shader_program.id, "current_cam");
+            master_shader_num_views_loc =
+                glGetUniformLocation(master_shader_program.id, "num_views");
+            master_shader_view_cams_loc =
+                glGetUniformLocation(master_shader_program.id, "view_cams");
             break;
         case ASSET_FONT_SHADER:
             font_shader_program = compile_shader_program_from_source(source);
@@ -535,16 +760,12 @@ void upload_shader(AssetID asset, const char *source) {
             break;
         case ASSET_POST_PROCESS_SHADER:
             source = Util::format(
-                    "const int num_screens = " STR(OPENGL_NUM_CAMERAS) ";\n"
-                    "uniform int num_active_samplers;\n"
-                    "uniform sampler2D screen_samplers[num_screens];\n"
+                    "uniform sampler2D screen_sampler;\n"
                     "%s", source);
             post_process_shader_program = compile_shader_program_from_source(source);
             ASSERT(post_process_shader_program, "Failed to compile shader");
             screen_texture_location = glGetUniformLocation(
-                post_process_shader_program.id, "screen_samplers");
-            num_screen_textures_location = glGetUniformLocation(
-                post_process_shader_program.id, "num_active_samplers");
+                post_process_shader_program.id, "screen_sampler");
             break;
         default:
             ERR("Invalid asset passed as shader (%d)", asset);
@@ -558,35 +779,59 @@ void blit() {
     glBufferSubData(GL_UNIFORM_BUFFER, 0, ubo_global_size, &_fog_global_window_state);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
+    frame_stats = {};
+    frame_stats.verticies = sprite_render_queue.total_number_of_verticies() +
+                            font_render_queue.total_number_of_verticies();
+    frame_stats.uploaded_bytes += sprite_render_queue.upload();
+    frame_stats.uploaded_bytes += font_render_queue.upload();
+
+    // The sprites are drawn once for each active camera, using
+    // instancing, and every instance is clipped to its own slice of
+    // the screen.
+    u32 num_views = 0;
+    u32 view_cams[OPENGL_NUM_CAMERAS];
     for (u32 cam = 0; cam < OPENGL_NUM_CAMERAS; cam++) {
-        glBindFramebuffer(GL_FRAMEBUFFER, screen_fbos[cam]);
-        clear();
-        u32 bit = (cam == 0) ? 1 : (1 << cam);
-        if (!(_fog_active_cameras & bit)) continue;
+        if (_fog_active_cameras & (1 << cam))
+            view_cams[num_views++] = cam;
+    }
 
+    glBindFramebuffer(GL_FRAMEBUFFER, screen_fbo);
+    clear();
+    if (num_views) {
         master_shader_program.bind();
-        glUniform1ui(master_shader_current_cam_loc, cam);
-        for (u32 layer = 0; layer < OPENGL_NUM_LAYERS; layer++)
-            sprite_render_queues[layer].draw();
+        glUniform1ui(master_shader_num_views_loc, num_views);
+        glUniform1uiv(master_shader_view_cams_loc, num_views, view_cams);
+        glEnable(GL_CLIP_DISTANCE0);
+        glEnable(GL_CLIP_DISTANCE1);
+        sprite_render_queue.draw(num_views);
+        glDisable(GL_CLIP_DISTANCE0);
+        glDisable(GL_CLIP_DISTANCE1);
 
-        font_shader_program.bind();
         // TODO(ed): Some way to do camera specific text or rendering
         // would probably be good.
-        glUniform1ui(master_shader_current_cam_loc, cam);
+        font_shader_program.bind();
         font_render_queue.draw();
     }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen ? output_fbo : 0);
     clear();
     render_post_processing();
     // TODO(ed): This is where screen space reflections can be rendered.
     // TODO(ed): Passing values is kinda tricky right now, might need some
     // way to pass uniforms to the shader...
 
-    SDL_GL_SwapWindow(window);
+    if (offscreen) {
+        // Waits for the frame, so timing "blit" times the whole frame.
+        glFinish();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    } else {
+        SDL_GL_SwapWindow(window);
+    }
 
     font_render_queue.clear();
-    for (u32 layer = 0; layer < OPENGL_NUM_LAYERS; layer++)
-        sprite_render_queues[layer].clear();
+    sprite_render_queue.clear();
+    draw_order = 0;
+    next_draw_order = 1;
+    last_frame_stats = frame_stats;
 }
 
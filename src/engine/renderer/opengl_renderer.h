@@ -10,81 +10,121 @@ struct Program {
     operator bool() const { return id != ERROR().id; }
 };
 
+// Marks a vertex that isn't textured, it only has a color.
+#define OPENGL_INVALID_SPRITE 0xFFFF
+
+// The verticies are kept small since all of them are sent to the
+// GPU every frame. The texture coordinates are stored as 16 bit
+// fractions between 0 and 1, and the color as 8 bits per channel.
 #pragma pack(push, 1)
 struct Vertex {
     Vec2 position;
-    Vec2 texture;
-    f32  sprite;
-    Vec4 color;
+    u16  texture[2];
+    u8   color[4];
+    u16  sprite;
+    u16  padding;
+
+    // Packs the vertex, a negative "sprite" means it's not textured.
+    static Vertex pack(Vec2 position, Vec2 texture, s32 sprite, Vec4 color);
 };
 
 struct SdfVertex {
     Vec2 position;
-    Vec2 texture;
-    f32  sprite;
-    Vec4 color;
-    f32  low;
-    f32  high;
-    s32  border;
+    u16  texture[2];
+    u8   color[4];
+    u16  sprite;
+    u16  border;
+    u16  low;
+    u16  high;
+
+    static SdfVertex pack(Vec2 position, Vec2 texture, s32 sprite, Vec4 color,
+                          f32 low, f32 high, bool border);
 };
 #pragma pack(pop)
 
-#define OPENGL_INVALID_SPRITE -1.0
-
 //
 // Used to render large batches of objects
 // with little hazzle.
 //
+// The verticies are gathered in memory, in one list per layer,
+// and sent to the GPU once a frame by "upload". All the layers
+// end up in the same buffer, one after the other, so the whole
+// queue is drawn with a single call.
+//
+// Every thread pushes to its own lists, so the workers can record
+// without locking. The lists are split into segments by the
+// "draw_order" they were pushed with, and "upload" puts the
+// segments of a layer in that order, so the frame looks the same
+// no matter which thread did what.
+//
+// Everything is drawn as quads, four verticies each, using
+// the shared "quad_index_buffer". A triangle is a quad where
+// the last corner is the same as the third.
+//
 template <typename T>
 struct RenderQueue {
-    u32 buffer_size;
-    // OpenGL objects for render context, also stored
-    // as initalized field.
-    u32 gl_draw_hint = 0;
+    // Verticies pushed by one thread with the same "draw_order".
+    struct Segment {
+        u32 order;
+        u32 first;
+        u32 length;
+    };
 
-    struct GLBuffer {
-        // How many VERTICIES to draw.
-        u32 draw_length;
-        // The buffer id.
-        u32 gl_buffer;
-        // The array object holding GLState.
-        u32 gl_array_object;
-
-        // NOTE(ed): There isn't an unbind call, this
-        // should be done by the methods.
-        void bind() {
-            glBindVertexArray(gl_array_object);
-            glBindBuffer(GL_ARRAY_BUFFER, gl_buffer);
-        }
+    struct Layer {
+        u32 length;
+        u32 capacity;
+        T *verticies;
+
+        u32 num_segments;
+        u32 max_segments;
+        Segment *segments;
     };
-    u32 next_free;
-    u32 num_buffers;
-    GLBuffer *vertex_buffers;
+    static constexpr u32 NUM_THREADS = Util::JobSystem::MAX_WORKERS + 1;
+    u32 num_layers;
+    // The layers of every thread, the ones for thread "t" start
+    // at "t * num_layers".
+    Layer *layers;
 
-    Util::MemoryArena *arena;
+    // OpenGL objects for render context, also stored
+    // as initalized field.
+    u32 gl_draw_hint = 0;
+    u32 gl_buffer;
+    u32 gl_array_object;
+    // How many verticies fit in the buffer on the GPU.
+    u32 gl_capacity;
+
+    // The ranges of the buffer to draw, worked out by "upload".
+    // The layers lie next to each other, so it's only split up
+    // when there are more quads than the index buffer has room for.
+    u32 num_draws;
+    u32 max_draws;
+    GLsizei *draw_counts;
+    GLint *draw_first_verticies;
 
     u32 total_number_of_verticies() const;
 
-    // Draw everything in the buffer to the screen.
-    void draw() const;
+    // Draw everything that was uploaded to the screen, "instances"
+    // times.
+    void draw(u32 instances = 1) const;
 
-    // Initalize a new queue that holds a specific number
-    // of triangles in each buffer.
-    void create(u32 triangels_per_buffer = 100);
+    // Initalize a new queue with "num_layers" layers, the
+    // main threads layers have room for some quads before they
+    // grow, the workers only get memory when they use it.
+    void create(u32 num_layers, u32 quads_per_layer = 100);
 
-    // Add more verticies to render.
-    void push(u32 num_new_verticies, T *new_verticies);
+    // Add more verticies to render, the corners of the quads
+    // in counter clockwise order. Can be called from any thread.
+    void push(u32 layer, u32 num_new_verticies, T *new_verticies);
 
-    // Expands the current queue by |GROW_BY| new buffers
-    // with |buffer_size| elements in them.
-    const u32 GROW_BY = 3;
-    void expand();
+    // Sends all the verticies to the GPU, returns the number
+    // of bytes sent.
+    u32 upload();
 
     // Enable the Attrib Pointers, this is the only
     // non generic part.
     void enable_attrib_pointer();
 
-    // Whipes all buffers to allow for new
+    // Whipes all layers to allow for new
     // data.
     void clear();
 
@@ -94,23 +134,52 @@ struct RenderQueue {
 
 // Render state
 Program master_shader_program;
-u32 master_shader_current_cam_loc;
+u32 master_shader_num_views_loc;
+u32 master_shader_view_cams_loc;
 Program font_shader_program;
 Program post_process_shader_program;
 
-RenderQueue<Vertex> sprite_render_queues[OPENGL_NUM_LAYERS];
+RenderQueue<Vertex> sprite_render_queue;
 RenderQueue<SdfVertex> font_render_queue;
 
+// The indicies of the two triangles in each quad, shared by all
+// render queues. A draw can't use more quads than there are
+// indicies for.
+const u32 OPENGL_MAX_QUADS_PER_DRAW = 0x10000 / 4;
+GLuint quad_index_buffer;
+
+// The order the pushes from this thread are drawn in, within each
+// layer. It's zero on the main thread until "parallel_draw" is
+// called, and the workers get one order for each chunk.
+thread_local u32 draw_order = 0;
+// The first order "parallel_draw" can hand out.
+u32 next_draw_order = 1;
+// Held when a list grows, since allocating isn't thread safe.
+std::mutex grow_lock;
+
+// Counted while drawing, and copied over when the frame is done.
+Stats frame_stats;
+Stats last_frame_stats;
+
 GLuint sprite_texture_array;
 
-GLuint screen_fbos[OPENGL_NUM_CAMERAS];
-GLuint screen_rbos[OPENGL_NUM_CAMERAS];
-GLuint screen_textures[OPENGL_NUM_CAMERAS];
+// All cameras draw to the same frame buffer, each on its own
+// slice of the screen.
+GLuint screen_fbo;
+GLuint screen_rbo;
+GLuint screen_texture;
 // A quad that covers the entire screen.
 GLuint screen_quad_vao;
 GLuint screen_quad_vbo;
 GLuint screen_texture_location;
-GLuint num_screen_textures_location;
+
+// When the renderer runs offscreen there's no window to show, so
+// the frame is drawn to "output_fbo" where it can be read back.
+bool offscreen = false;
+GLuint output_fbo;
+GLuint output_rbo;
+int output_width;
+int output_height;
 
 
 
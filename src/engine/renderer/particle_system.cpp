@@ -98,22 +98,31 @@ void ParticleSystem::update(f32 delta) {
 
 void ParticleSystem::draw() {
     ASSERT(particles, "Trying to use uninitalized/destroyed particle system");
-    u32 i = head;
     Vec2 p = relative ? position : V2(0, 0);
-    do {
-        i %= max_num_particles;
-        if (num_sub_sprites) {
-            SubSprite sprite = sub_sprites[particles[i].sprite];
-            particles[i].render(layer, p, sprite.texture, sprite.min, sprite.dim);
-        } else {
-            particles[i].render(layer, p, -1, V2(0, 0), V2(0, 0));
+    // The buffer is full when the head has caught up with the tail.
+    u32 count = (tail + max_num_particles - head) % max_num_particles;
+    if (count == 0) count = max_num_particles;
+    // Fetching can upload the texture, so the slices are looked up
+    // here and the workers only read them. A texture that's fetched
+    // isn't evicted until the next frame.
+    for (u32 i = 0; i < num_sub_sprites; i++)
+        sub_sprites[i].slice = Asset::fetch_image(sub_sprites[i].texture)->id;
+    Renderer::parallel_draw(count, 256, [this, p](u32 begin, u32 end) {
+        for (u32 j = begin; j < end; j++) {
+            u32 i = (head + j) % max_num_particles;
+            if (num_sub_sprites) {
+                SubSprite sprite = sub_sprites[particles[i].sprite];
+                particles[i].render(layer, p, sprite.slice, sprite.min, sprite.dim);
+            } else {
+                particles[i].render(layer, p, -1, V2(0, 0), V2(0, 0));
+            }
         }
-    } while ((i = (i + 1) % max_num_particles) != tail);
+    });
 }
 
 void ParticleSystem::add_sprite(AssetID texture, u32 u, u32 v, u32 w, u32 h){
     ASSERT(particles, "Trying to use uninitalized/destroyed particle system");
-    SubSprite sub_sprite = {Asset::fetch_image(texture)->id,
+    SubSprite sub_sprite = {texture, -1,
         V2(u, v),
         V2(w, h)};
     ASSERT(num_sub_sprites != MAX_NUM_SUB_SPRITES,
@@ -41,8 +41,11 @@ struct Particle {
 struct ParticleSystem {
     Util::MemoryArena *memory;
 
+    // The texture is looked up every time the particles are drawn,
+    // it can be moved to another slice between frames.
     struct SubSprite {
-        u16 texture;
+        AssetID texture;
+        s32 slice;
         Vec2 min;
         Vec2 dim;
     };
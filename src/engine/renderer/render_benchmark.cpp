@@ -0,0 +1,248 @@
+namespace Renderer {
+
+// Frames drawn before the timing starts, so the queues have grown.
+static constexpr u32 BENCHMARK_WARMUP_FRAMES = 5;
+static constexpr u32 BENCHMARK_FRAMES = 60;
+static constexpr u32 BENCHMARK_SPRITES = 20000;
+static constexpr u32 BENCHMARK_LINES = 4000;
+static constexpr u32 BENCHMARK_PARTICLES = 20000;
+// Drivers round a little differently, so a channel may be this far
+// off from the golden image...
+static constexpr u32 BENCHMARK_TOLERANCE = 8;
+// ...and this many pixels in a thousand can be off by more.
+static constexpr u32 BENCHMARK_BAD_PIXELS_PER_THOUSAND = 1;
+
+struct BenchmarkAssets {
+    AssetID texture;
+    AssetID font;
+    ParticleSystem particles;
+};
+
+// Somewhere in [-1, 1], the same for the same "i" and "seed".
+static f32 benchmark_noise(u32 i, u32 seed) {
+    u32 x = (i + 1) * 0x9E3779B9 ^ (seed + 1) * 0x85EBCA6B;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6D;
+    x ^= x >> 12;
+    return (x & 0xFFFF) / (f32) 0xFFFF * 2.0 - 1.0;
+}
+
+// Lots of rotating sprites, spread over all the layers.
+static void benchmark_sprites(BenchmarkAssets *assets, u32 frame) {
+    Image *image = Asset::fetch_image(assets->texture);
+    Vec2 uv_dimension = V2(image->width, image->height);
+    f32 time = frame / 60.0;
+    for (u32 i = 0; i < BENCHMARK_SPRITES; i++) {
+        Vec2 position = V2(benchmark_noise(i, 0), benchmark_noise(i, 1)) * 1.2;
+        Vec2 velocity = V2(benchmark_noise(i, 2), benchmark_noise(i, 3)) * 0.1;
+        f32 size = 0.02 + 0.03 * ABS(benchmark_noise(i, 4));
+        Vec4 color = V4(0.5 + 0.5 * benchmark_noise(i, 5),
+                        0.5 + 0.5 * benchmark_noise(i, 6), 1.0, 0.8);
+        push_sprite(i % OPENGL_NUM_LAYERS, position + velocity * time,
+                    V2(size, size), benchmark_noise(i, 7) * PI + time,
+                    assets->texture, V2(0, 0), uv_dimension, color);
+    }
+}
+
+// Like the debug view, a grid with lines, points and boxes on top.
+static void benchmark_lines(BenchmarkAssets *assets, u32 frame) {
+    for (s32 i = -10; i <= 10; i++) {
+        Vec4 color = V4(0.3, 0.3, 0.3, 1.0);
+        push_line(0, V2(i * 0.1, -1.0), V2(i * 0.1, 1.0), color, 0.003);
+        push_line(0, V2(-1.0, i * 0.1), V2(1.0, i * 0.1), color, 0.003);
+    }
+    f32 time = frame / 60.0;
+    for (u32 i = 0; i < BENCHMARK_LINES; i++) {
+        Vec2 start = V2(benchmark_noise(i, 0), benchmark_noise(i, 1));
+        f32 angle = benchmark_noise(i, 2) * PI + time;
+        Vec2 end = start + V2(cos(angle), sin(angle)) * 0.1;
+        push_line(1 + i % 2, start, end, V4(1, 0, 0, 1), V4(0, 1, 0, 1),
+                  0.002 + 0.004 * ABS(benchmark_noise(i, 3)));
+        if (i % 4 == 0)
+            push_point(3, end, V4(1, 1, 0, 1), 0.01);
+        if (i % 16 == 0)
+            push_rectangle(4, start, V2(0.04, 0.04), V4(0, 0.5, 1, 0.3));
+    }
+}
+
+// Lines that stay the same, like the labels of a menu, and lines
+// that change every frame, like a timer.
+static void benchmark_text(BenchmarkAssets *assets, u32 frame) {
+    for (u32 i = 0; i < 30; i++) {
+        f32 y = 0.95 - i * 0.065;
+        f32 alignment = (i % 3) * -0.5;
+        f32 x = -0.95 - alignment * 1.9;
+        Vec4 color = V4(1.0, 1.0 - i * 0.03, 0.5 + i * 0.015, 1.0);
+        const char *string;
+        if (i % 5 == 0)
+            string = Util::format("Frame %u, line %u", frame, i);
+        else if (i % 5 == 1)
+            string = "A line that is longer than what the layout cache keeps, so it's laid out every time";
+        else
+            string = Util::format("Label number %u: AVAWAY", i);
+        draw_text(string, x, y, 0.6, assets->font, alignment, color, 0.2,
+                  i % 4 == 0);
+    }
+}
+
+// A particle system, which is drawn on the workers.
+static void benchmark_particles(BenchmarkAssets *assets, u32 frame) {
+    for (u32 i = 0; i < BENCHMARK_PARTICLES / 60; i++)
+        assets->particles.spawn();
+    assets->particles.update(1.0 / 60.0);
+    assets->particles.draw();
+}
+
+// The frame is stored upside down, like OpenGL reads it.
+static bool write_ppm(const char *path, const u8 *pixels, u32 width, u32 height) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        ERR("Failed to open \"%s\"", path);
+        return false;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    bool written = true;
+    for (s32 y = height - 1; y >= 0; y--)
+        written &= fwrite(pixels + y * width * 3, 3, width, file) == width;
+    fclose(file);
+    if (!written)
+        ERR("Failed to write \"%s\"", path);
+    return written;
+}
+
+static bool read_ppm(const char *path, u8 *pixels, u32 width, u32 height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    u32 file_width, file_height, max_value;
+    bool valid = fscanf(file, "P6 %u %u %u", &file_width, &file_height, &max_value) == 3
+                 && fgetc(file) != EOF
+                 && file_width == width && file_height == height && max_value == 255;
+    for (s32 y = height - 1; valid && y >= 0; y--)
+        valid &= fread(pixels + y * width * 3, 3, width, file) == width;
+    fclose(file);
+    if (!valid)
+        ERR("\"%s\" isn't a %ux%u image", path, width, height);
+    return valid;
+}
+
+// Checks the frame against "<golden_dir>/<name>.ppm", the golden
+// image is recorded if there isn't one.
+static bool compare_golden(const char *golden_dir, const char *name,
+                           const u8 *pixels, u8 *golden, u32 width, u32 height) {
+    const char *path = Util::format("%s/%s.ppm", golden_dir, name);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("  recorded %s\n", path);
+        return write_ppm(path, pixels, width, height);
+    }
+    fclose(file);
+    if (!read_ppm(path, golden, width, height))
+        return false;
+
+    u32 bad_pixels = 0;
+    u32 max_difference = 0;
+    for (u32 i = 0; i < width * height; i++) {
+        u32 difference = 0;
+        for (u32 c = 0; c < 3; c++)
+            difference = MAX(difference, (u32) ABS(pixels[i * 3 + c] - golden[i * 3 + c]));
+        max_difference = MAX(max_difference, difference);
+        bad_pixels += difference > BENCHMARK_TOLERANCE;
+    }
+    bool passed = bad_pixels * 1000 <= width * height * BENCHMARK_BAD_PIXELS_PER_THOUSAND;
+    printf("  %u pixels differ from %s, by at most %u\n", bad_pixels, path, max_difference);
+    if (!passed) {
+        const char *failed_path = Util::format("%s/%s.failed.ppm", golden_dir, name);
+        ERR("\"%s\" doesn't match the golden image, the frame is in \"%s\"", name,
+            failed_path);
+        write_ppm(failed_path, pixels, width, height);
+    }
+    return passed;
+}
+
+bool run_benchmark(const char *golden_dir) {
+    ASSERT(Impl::offscreen, "The benchmark needs an offscreen renderer");
+    BenchmarkAssets assets = {Asset::ASSET_ID_NO_ASSET, Asset::ASSET_ID_NO_ASSET};
+    for (AssetID id = 0; id < Asset::system.file_header.number_of_assets; id++) {
+        Asset::Type type = Asset::system.headers[id].type;
+        if (type == Asset::Type::TEXTURE && assets.texture == Asset::ASSET_ID_NO_ASSET)
+            assets.texture = id;
+        if (type == Asset::Type::FONT && assets.font == Asset::ASSET_ID_NO_ASSET)
+            assets.font = id;
+    }
+    if (assets.texture == Asset::ASSET_ID_NO_ASSET || assets.font == Asset::ASSET_ID_NO_ASSET) {
+        ERR("The benchmark needs a texture and a font to draw");
+        return false;
+    }
+
+    struct Scene {
+        const char *name;
+        void (*draw)(BenchmarkAssets *assets, u32 frame);
+    } scenes[] = {
+        {"sprites", benchmark_sprites},
+        {"lines", benchmark_lines},
+        {"text", benchmark_text},
+        {"particles", benchmark_particles},
+    };
+
+    u32 width = Impl::output_width;
+    u32 height = Impl::output_height;
+    Util::allow_allocation();
+    u8 *pixels = Util::push_memory<u8>(width * height * 3);
+    Util::allow_allocation();
+    u8 *golden = Util::push_memory<u8>(width * height * 3);
+
+    for (u32 cam = 1; cam < OPENGL_NUM_CAMERAS; cam++)
+        turn_off_camera(cam);
+    turn_on_camera(0);
+    get_camera(0)->position = V2(0, 0);
+    get_camera(0)->offset = V2(0, 0);
+    get_camera(0)->zoom = 1.0;
+    // The particles use the random numbers, so the same ones are
+    // drawn every time.
+    init_random();
+    assets.particles = create_particle_system(5, BENCHMARK_PARTICLES, V2(0, 0));
+    Image *image = Asset::fetch_image(assets.texture);
+    assets.particles.add_sprite(assets.texture, 0, 0, image->width, image->height);
+    assets.particles.spawn_size = {0.02, 0.05};
+    assets.particles.velocity_dir = {0.0, 2.0 * PI};
+    assets.particles.velocity = {0.1, 0.8};
+    assets.particles.spawn_red = {0.5, 1.0};
+    assets.particles.die_alpha = {0.0, 0.2};
+
+    printf("Rendered %u frames of each scene at %ux%u:\n", BENCHMARK_FRAMES,
+           width, height);
+    bool passed = true;
+    for (Scene &scene : scenes) {
+        f64 total_time = 0.0;
+        f64 best_time = 0.0;
+        for (u32 frame = 0; frame < BENCHMARK_WARMUP_FRAMES + BENCHMARK_FRAMES; frame++) {
+            u64 start = Perf::highp_now();
+            clear();
+            scene.draw(&assets, frame);
+            blit();
+            f64 time = (Perf::highp_now() - start) / 1000.0;
+            if (frame < BENCHMARK_WARMUP_FRAMES) continue;
+            total_time += time;
+            best_time = frame == BENCHMARK_WARMUP_FRAMES ? time : MIN(best_time, time);
+        }
+        Stats stats = get_stats();
+        printf("  %-10s %7.3f ms avg, %7.3f ms best, %4u draw calls, "
+               "%6u verticies, %8llu bytes\n",
+               scene.name, total_time / BENCHMARK_FRAMES, best_time,
+               stats.draw_calls, stats.verticies,
+               (unsigned long long) stats.uploaded_bytes);
+
+        if (golden_dir) {
+            read_pixels(pixels);
+            passed &= compare_golden(golden_dir, scene.name, pixels, golden,
+                                     width, height);
+        }
+    }
+
+    destroy_particle_system(&assets.particles);
+    Util::pop_memory(pixels);
+    Util::pop_memory(golden);
+    return passed;
+}
+
+}  // namespace Renderer
@@ -1,19 +1,95 @@
 namespace Renderer {
 
+// Laying out a string looks up the kerning of every pair of glyphs,
+// so the quads are kept around. Most text, like the score, is drawn
+// every frame and rarely changes. The layouts are made with a size
+// of 1 and scaled when they're pushed.
+const u32 TEXT_LAYOUT_CACHE_SIZE = 64;
+const u32 TEXT_LAYOUT_MAX_LENGTH = 64;
+
+struct TextLayout {
+    AssetID font;
+    u32 length;
+    char string[TEXT_LAYOUT_MAX_LENGTH];
+
+    f32 width;
+    u32 num_quads;
+    SdfQuad quads[TEXT_LAYOUT_MAX_LENGTH];
+};
+
+// Only touched on the main thread, since the fonts are fetched there.
+TextLayout text_layouts[TEXT_LAYOUT_CACHE_SIZE] = {};
+
+static u32 hash_text(const char *string, u32 length, AssetID font_id) {
+    u32 hash = 2166136261u ^ (u32) font_id;
+    for (u32 i = 0; i < length; i++)
+        hash = (hash ^ (u8) string[i]) * 16777619u;
+    return hash;
+}
+
+// Walks the glyphs of "string" in a size of 1, calls "emit" with
+// the quad of every visible glyph and returns the width of the text.
+template <typename F>
+static f32 layout_text(const char *string, Asset::Font *font, F emit) {
+    f32 x = 0;
+    u8 prev = '\0';
+    Asset::Font::Glyph std = font->glyphs[(u8) 'A'];
+    while (*string) {
+        u8 curr = *(string++);
+        Asset::Font::Glyph glyph = font->glyphs[curr];
+        if (font->num_kernings) {
+            x += font->find_kerning(prev, curr);
+            prev = curr;
+        }
+        if (glyph.w) {
+            Vec2 p = {x + glyph.x_offset, -(glyph.h + glyph.y_offset)};
+            Vec2 uv = {glyph.x, glyph.y};
+            Vec2 span = {glyph.w, glyph.h};
+            emit({p, p + span, uv, uv + span});
+        }
+        if (font->num_kernings)
+            x += glyph.advance + glyph.x_offset;
+        else
+            x += std.advance;
+    }
+    return x;
+}
+
+// Finds the layout in the cache, or makes a new one. Returns null if
+// the string is too long to be cached.
+static TextLayout *fetch_layout(const char *string, AssetID font_id,
+                                Asset::Font *font) {
+    u32 length = 0;
+    while (string[length]) {
+        if (++length > TEXT_LAYOUT_MAX_LENGTH) return nullptr;
+    }
+    u32 hash = hash_text(string, length, font_id);
+    TextLayout *layout = text_layouts + hash % TEXT_LAYOUT_CACHE_SIZE;
+    if (layout->font == font_id && layout->length == length) {
+        u32 same = 0;
+        while (same < length && layout->string[same] == string[same]) same++;
+        if (same == length) return layout;
+    }
+
+    layout->font = font_id;
+    layout->length = length;
+    Util::copy_bytes((void *) string, layout->string, length);
+    layout->num_quads = 0;
+    layout->width = layout_text(string, font, [layout](SdfQuad quad) {
+        layout->quads[layout->num_quads++] = quad;
+    });
+    return layout;
+}
+
 Vec2 messure_text(const char *string, f32 size, AssetID font_id) {
     Asset::Font *font = Asset::fetch_font(font_id);
     ASSERT(font, "Cannot find font");
-    f32 length = 0;
-    if (!font->num_kernings) {
-        while (*(string++)) length += font->glyphs[(u8) 'A'].advance;
-    } else {
-        u8 prev = '\0';
-        while (*string) {
-            u8 curr = *(string++);
-            length += font->find_kerning(prev, curr);
-            length += font->glyphs[curr].advance + font->glyphs[curr].x_offset;
-        }
-    }
+    f32 length;
+    TextLayout *layout = fetch_layout(string, font_id, font);
+    if (layout)
+        length = layout->width;
+    else
+        length = layout_text(string, font, [](SdfQuad) {});
     return V2(length * size, size * font->height);
 }
 
@@ -25,47 +101,33 @@ void draw_text(const char *string, f32 x, f32 y, f32 size, AssetID font_id,
     START_PERF(TEXT);
     Asset::Font *font = Asset::fetch_font(font_id);
     ASSERT(font, "Cannot find font, the \"id\" passed in should end with _FONT");
-    Vec2 offset = V2(0, 0);
-    if (alignment)
-        offset = V2(alignment * messure_text(string, size, font_id).x, 0.0);
-
-    if (!font->num_kernings) {
-        Asset::Font::Glyph std = font->glyphs[(u8) 'A'];
-        while (*string) {
-            u8 curr = *(string++);
-            Asset::Font::Glyph glyph = font->glyphs[curr];
-            if (glyph.w) {
-                Vec2 p = {x + (glyph.x_offset) * size,
-                          y + (glyph.h + glyph.y_offset) * -size};
-                Vec2 uv = {glyph.x, glyph.y};
-                Vec2 span = {glyph.w, glyph.h};
-                Renderer::push_sdf_quad(p + offset, p + offset + span * size,
-                                        uv, uv + span,
-                                        font->texture, color, 0.4, 0.4 + edge,
-                                        border);
-            }
-            x += std.advance * size;
-        }
+    TextLayout *layout = fetch_layout(string, font_id, font);
+    if (layout) {
+        Vec2 offset = V2(x + alignment * layout->width * size, y);
+        Renderer::push_sdf_quads(layout->num_quads, layout->quads, offset,
+                                 size, font->texture, color, 0.4, 0.4 + edge,
+                                 border);
     } else {
-        u8 prev = '\0';
-        while (*string) {
-            u8 curr = *(string++);
-            f32 kerning = font->find_kerning(prev, curr);
-            x += kerning * size;
-            Asset::Font::Glyph glyph = font->glyphs[curr];
+        // Too long to be cached, so it's pushed in parts.
+        f32 width = 0;
+        if (alignment)
+            width = layout_text(string, font, [](SdfQuad) {});
+        Vec2 offset = V2(x + alignment * width * size, y);
 
-            if (glyph.w) {
-                Vec2 p = {x + (glyph.x_offset) * (size),
-                          y + (glyph.h + glyph.y_offset) * (-size)};
-                Vec2 uv = {glyph.x, glyph.y};
-                Vec2 span = {glyph.w, glyph.h};
-                Renderer::push_sdf_quad(p + offset, p + offset + span * size,
-                                        uv, uv + span,
-                                        font->texture, color, 0.4, 0.4 + edge,
-                                        border);
-            }
-            x += (glyph.advance + glyph.x_offset) * size;
-        }
+        const u32 BATCH = 64;
+        SdfQuad quads[BATCH];
+        u32 num_quads = 0;
+        const auto flush = [&]() {
+            Renderer::push_sdf_quads(num_quads, quads, offset, size,
+                                     font->texture, color, 0.4, 0.4 + edge,
+                                     border);
+            num_quads = 0;
+        };
+        layout_text(string, font, [&](SdfQuad quad) {
+            quads[num_quads++] = quad;
+            if (num_quads == BATCH) flush();
+        });
+        flush();
     }
     STOP_PERF(TEXT);
 }
@@ -4,7 +4,8 @@ namespace Renderer {
 ///# Text
 // Drawing text can be quite usefull, and is simple to do using
 // the supplied API. One thing to remember is that text is allways
-// drawn ontop of everything else.
+// drawn ontop of everything else, and that the font is fetched, so
+// text is drawn from the main thread.
 
 ///*
 // Return the dimension the string would have if printed in
@@ -15,6 +15,10 @@
 #include "util/debug.cpp"
 #include "math/block_math.h"
 #include "asset/asset.h"
+#include "util/compression.h"
+#include "util/compression.cpp"
+#include "util/resample.h"
+#include "util/resample.cpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -57,6 +61,10 @@ struct AssetFile {
 };
 
 std::unordered_map<std::string, Asset::Type> valid_endings;
+bool compress_assets = true;
+// Sounds are converted to this rate if it's set, so
+// the mixer doesn't have to.
+u32 sound_sample_rate = 0;
 
 // Generate a source file containing IDs to the source code.
 
@@ -135,7 +143,7 @@ void load_font(AssetFile *file, Asset::Header *header) {
         sdf_header.file_path[header->file_path_length - 4] = 's';
         load_texture(file, &sdf_header);
         assert(sdf_header.asset_id != 0xFFFFFFF);
-        font.texture = file->assets[sdf_header.asset_id].image.id;
+        font.texture_asset = sdf_header.asset_id;
     }
     float inv_width  = 1.0 / OPENGL_TEXTURE_WIDTH;
     float inv_height = 1.0 / OPENGL_TEXTURE_HEIGHT;
@@ -219,6 +227,38 @@ void load_atlas(AssetFile *file, Asset::Header *header) {
     printf("Trying to load atlas, but code is not implemented\n");
 }
 
+// Resamples the frames in "data" from "from_rate" to "to_rate",
+// "data" is replaced with the new frames.
+bool convert_sample_rate(u8 **data, u64 *size, u32 channels, u32 bitdepth,
+                         u32 from_rate, u32 to_rate) {
+    if (bitdepth != 16 && bitdepth != 32) return false;
+    u64 num_samples = *size / (bitdepth / 8);
+    u64 num_frames = num_samples / channels;
+    f32 *samples = (f32 *) malloc(num_samples * sizeof(f32));
+    for (u64 i = 0; i < num_samples; i++) {
+        if (bitdepth == 16)
+            samples[i] = ((s16 *) *data)[i] / 32768.0f;
+        else
+            samples[i] = ((f32 *) *data)[i];
+    }
+
+    u64 num_out = Util::resampled_length(num_frames, from_rate, to_rate);
+    f32 *resampled = (f32 *) malloc(num_out * channels * sizeof(f32));
+    Util::resample_offline(samples, num_frames, channels, from_rate, to_rate, resampled);
+    free(samples);
+
+    *size = num_out * channels * (bitdepth / 8);
+    *data = (u8 *) realloc(*data, *size);
+    for (u64 i = 0; i < num_out * channels; i++) {
+        if (bitdepth == 16)
+            ((s16 *) *data)[i] = CLAMP(-32768.0f, 32767.0f, roundf(resampled[i] * 32768.0f));
+        else
+            ((f32 *) *data)[i] = resampled[i];
+    }
+    free(resampled);
+    return true;
+}
+
 void load_sound(AssetFile *file, Asset::Header *header) {
     FILE *wav_file = fopen(header->file_path, "rb");
     fseek(wav_file, 0, SEEK_END);
@@ -259,11 +299,21 @@ void load_sound(AssetFile *file, Asset::Header *header) {
         }
     }
 
+    u32 sample_rate = wav_header.sample_rate;
+    if (sound_sample_rate && sound_sample_rate != sample_rate) {
+        if (convert_sample_rate(&data, &size, wav_header.channels,
+                                wav_header.bitdepth, sample_rate, sound_sample_rate))
+            sample_rate = sound_sample_rate;
+        else
+            printf("Failed to resample \"%s\", only 16 and 32 bit sounds can be (%d)\n",
+                   header->file_path, wav_header.bitdepth);
+    }
+
     Sound sound;
     sound.data = data;
     sound.size = size;
     sound.num_samples = size / (wav_header.channels * wav_header.bitdepth / 8);
-    sound.sample_rate = wav_header.sample_rate;
+    sound.sample_rate = sample_rate;
     sound.bits_per_sample = wav_header.bitdepth;
     sound.is_stereo = 1 < wav_header.channels;
 
@@ -300,6 +350,23 @@ size_t write_to_file(FILE *stream, const T *ptr, size_t num = 1) {
     return write * sizeof(T);
 }
 
+// Writes the data after the Data struct, compressed if it makes
+// the asset noticeably smaller.
+void write_body(FILE *stream, Asset::Header *header, const u8 *data, u64 size) {
+    header->compression = Asset::Compression::NONE;
+    if (compress_assets && size) {
+        u8 *compressed = (u8 *) malloc(Util::compress_blocks_bound(size));
+        u64 compressed_size = Util::compress_blocks(data, size, compressed);
+        if (compressed_size < size - size / 8) {
+            header->compression = Asset::Compression::BLOCKS;
+            write_to_file(stream, compressed, compressed_size);
+        }
+        free(compressed);
+    }
+    if (header->compression == Asset::Compression::NONE)
+        write_to_file(stream, data, size);
+}
+
 char *copy_string(char *str, u32 size) {
     char *ptr = str;
     char *out = (char *) malloc(size);
@@ -398,21 +465,24 @@ void dump_asset_file(AssetFile *file, const char *out_path) {
                 write_to_file(output_file, &asset);
                 u64 size = asset.image.width * asset.image.height *
                            asset.image.components;
-                write_to_file(output_file, asset.image.data, size);
+                write_body(output_file, header, asset.image.data, size);
             } break;
             case (Asset::Type::SHADER): {
                 write_to_file(output_file, asset.shader_source, header->asset_size);
             } break;
             case (Asset::Type::FONT): {
                 write_to_file(output_file, &asset);
-                u64 num_glyphs = asset.font.num_glyphs;
-                write_to_file(output_file, asset.font.glyphs, num_glyphs);
-                u64 num_kernings = asset.font.num_kernings;
-                write_to_file(output_file, asset.font.kernings, num_kernings);
+                u64 glyphs_size = asset.font.num_glyphs * sizeof(Asset::Font::Glyph);
+                u64 kernings_size = asset.font.num_kernings * sizeof(Asset::Font::Kerning);
+                std::vector<u8> body(glyphs_size + kernings_size);
+                memcpy(body.data(), asset.font.glyphs, glyphs_size);
+                if (kernings_size)
+                    memcpy(body.data() + glyphs_size, asset.font.kernings, kernings_size);
+                write_body(output_file, header, body.data(), body.size());
             } break;
             case (Asset::Type::SOUND): {
                 write_to_file(output_file, &asset);
-                write_to_file(output_file, asset.sound.data, asset.sound.size);
+                write_body(output_file, header, asset.sound.data, asset.sound.size);
             } break;
             default:
                 printf("UNIMPLEMENTED ASSET TYPE\n");
@@ -422,8 +492,11 @@ void dump_asset_file(AssetFile *file, const char *out_path) {
         header->asset_size = ftell(output_file) - header->offset;
     }
     u64 data_end = ftell(output_file);
-    assert(data_end - data_begin == file->header.size_of_data);
+    // Smaller than the sum of the assets if any were compressed.
+    file->header.size_of_data = data_end - data_begin;
 
+    rewind(output_file);
+    write_to_file(output_file, &file->header);
     fseek(output_file, header_location, SEEK_SET);
     write_to_file(output_file, &file->asset_headers[0],
                   file->header.number_of_assets);
@@ -461,13 +534,16 @@ int main(int nargs, char **vargs) {
 
     printf("\n\t=== FINDING ===\n");
 
-    // TODO(ed): Some form of compression on this data
-    // would make it a lot less space savy
     AssetFile file = {};
     const char *out_path = "bin/data.fog";
     for (int i = 0; i < nargs; i++) {
         if (std::strcmp(vargs[i], "-o") == 0) {
             out_path = vargs[++i];
+        } else if (std::strcmp(vargs[i], "--no-compression") == 0) {
+            compress_assets = false;
+        } else if (std::strcmp(vargs[i], "--sample-rate") == 0) {
+            // The mixer plays at Mixer::AUDIO_SAMPLE_RATE.
+            sound_sample_rate = atoi(vargs[++i]);
         } else {
             std::string path = vargs[i];
             process_asset(&file, &path);
@@ -26,12 +26,17 @@ bool debug_values_are_on();
 #include "util/performance.h"
 #include "util/block_list.h"
 #include "platform/input.h"
-#include "renderer/command.h"
 #include "renderer/camera.h"
 #include "renderer/particle_system.h"
 #include "logic/logic.h"
+#include "util/jobs.h"
+#include "renderer/command.h"
+#include "util/compression.h"
+#include "util/resample.h"
 #include "logic/entity.h"
 #include "logic/block_physics.h"
+#include "logic/snapshot.h"
+#include "logic/level_stream.h"
 
 #include "math.h"
 
@@ -39,6 +44,9 @@ bool debug_values_are_on();
 #include "util/io.cpp"
 #include "util/argument.cpp"
 #include "util/memory.cpp"
+#include "util/jobs.cpp"
+#include "util/compression.cpp"
+#include "util/resample.cpp"
 #include "platform/input.cpp"
 #include "renderer/command.cpp"
 #include "renderer/text.cpp"
@@ -50,9 +58,16 @@ bool debug_values_are_on();
 #include "logic/logic.cpp"
 #include "logic/entity.cpp"
 #include "logic/block_physics.cpp"
+#include "logic/snapshot.cpp"
+#include "logic/level_stream.cpp"
+#include "logic/entity_benchmark.cpp"
 
+#include "platform/effect.h"
 #include "platform/mixer.h"
+#include "platform/effect.cpp"
 #include "platform/mixer.cpp"
+#include "platform/mixer_benchmark.cpp"
+#include "renderer/render_benchmark.cpp"
 
 #ifdef SDL
 #include "platform/input_sdl.cpp"
@@ -163,6 +178,12 @@ int main(int argc, char **argv) {
     using namespace Util;
     u32 win_width = 500;
     u32 win_height = 500;
+    bool audio_benchmark_mode = false;
+    const char *audio_out_path = nullptr;
+    u64 expected_audio_checksum = 0;
+    bool render_benchmark_mode = false;
+    const char *render_golden_dir = nullptr;
+    bool entity_benchmark_mode = false;
     u32 index = 1;
     while (index < argc) {
         switch (parse_str_argument(argv[index])) {
@@ -171,6 +192,30 @@ int main(int argc, char **argv) {
             win_height = (u32) atoi(argv[index + 2]);
             index += 3;
             break;
+        case audio_benchmark:
+            audio_benchmark_mode = true;
+            index++;
+            break;
+        case audio_out:
+            audio_out_path = argv[index + 1];
+            index += 2;
+            break;
+        case audio_checksum:
+            expected_audio_checksum = strtoull(argv[index + 1], nullptr, 16);
+            index += 2;
+            break;
+        case render_benchmark:
+            render_benchmark_mode = true;
+            index++;
+            break;
+        case render_golden:
+            render_golden_dir = argv[index + 1];
+            index += 2;
+            break;
+        case entity_benchmark:
+            entity_benchmark_mode = true;
+            index++;
+            break;
         default:
             LOG("Invalid argument '%s'", argv[index]);
             index++;
@@ -181,6 +226,33 @@ int main(int argc, char **argv) {
     init_random();
 
     Util::do_all_allocations();
+    ASSERT(Util::init_jobs(), "Failed to start worker threads");
+    if (audio_benchmark_mode) {
+        // Runs without a window or an audio device.
+        ASSERT(Mixer::init_offline(), "Failed to initalize audio mixer");
+        ASSERT(Asset::load("data.fog", false), "Failed to load assets");
+        bool passed = Mixer::run_benchmark(audio_out_path, expected_audio_checksum);
+        Asset::stop_loader();
+        Util::stop_jobs();
+        return passed ? 0 : 1;
+    }
+    if (render_benchmark_mode) {
+        // Draws to memory, so it runs without a display.
+        ASSERT(Renderer::init_offscreen(win_width, win_height),
+               "Failed to initalize renderer");
+        ASSERT(Asset::load("data.fog"), "Failed to load assets");
+        bool passed = Renderer::run_benchmark(render_golden_dir);
+        Asset::stop_loader();
+        Util::stop_jobs();
+        return passed ? 0 : 1;
+    }
+    if (entity_benchmark_mode) {
+        ASSERT(Logic::init(), "Failed to initalize logic system");
+        ASSERT(Logic::init_entity(), "Failed to initalize entites");
+        bool passed = Logic::run_benchmark();
+        Util::stop_jobs();
+        return passed ? 0 : 1;
+    }
     ASSERT(Renderer::init("Hello there", win_width, win_height),
            "Failed to initalize renderer");
     ASSERT(Mixer::init(),
@@ -214,13 +286,21 @@ int main(int argc, char **argv) {
         if (value(Name::QUIT, Player::ANY))
             SDL::running = false;
 
+        START_PERF(ASSET_UPLOAD);
+        Asset::pump_uploads();
+        STOP_PERF(ASSET_UPLOAD);
+
+        START_PERF(LEVEL_STREAM);
+        Logic::update_level_stream();
+        STOP_PERF(LEVEL_STREAM);
+
         Logic::call(Logic::At::PRE_UPDATE);
         // User defined
         update();
         Logic::update_es();
         Logic::call(Logic::At::POST_UPDATE);
 
-        Mixer::audio_struct.position = Renderer::get_camera()->position;
+        Mixer::listen_from_camera();
 
         START_PERF(RENDER);
         Renderer::clear();
@@ -233,6 +313,7 @@ int main(int argc, char **argv) {
 
         Renderer::blit();
         STOP_PERF(RENDER);
+        Asset::end_frame();
 
         Logic::defragment_entity_memory();
 
@@ -245,5 +326,8 @@ int main(int argc, char **argv) {
 
 void _fog_close_app_responsibly() {
     Renderer::Impl::set_fullscreen(false);
+    Logic::close_level_stream();
+    Asset::stop_loader();
+    Util::stop_jobs();
 }
 
@@ -2,6 +2,12 @@ namespace Util {
 
 Argument parse_str_argument(char *input) {
     if (str_eq(input, "--resolution") || str_eq(input, "-r")) return resolution;
+    if (str_eq(input, "--audio-benchmark")) return audio_benchmark;
+    if (str_eq(input, "--audio-out")) return audio_out;
+    if (str_eq(input, "--audio-checksum")) return audio_checksum;
+    if (str_eq(input, "--render-benchmark")) return render_benchmark;
+    if (str_eq(input, "--render-golden")) return render_golden;
+    if (str_eq(input, "--entity-benchmark")) return entity_benchmark;
     return INVALID;
 }
 
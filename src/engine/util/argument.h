@@ -2,6 +2,12 @@ namespace Util {
 
 enum Argument {
     resolution,
+    audio_benchmark,
+    audio_out,
+    audio_checksum,
+    render_benchmark,
+    render_golden,
+    entity_benchmark,
 
     INVALID
 };
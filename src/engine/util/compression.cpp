@@ -0,0 +1,183 @@
+namespace Util {
+
+// The compressed data is a list of sequences, each sequence is:
+//
+// Token: upper 4 bits are the number of literals, lower
+//        4 bits the length of the match minus MIN_MATCH.
+//        15 means more length follows, as bytes that are
+//        added until one isn't 255.
+// Literals
+// Offset: 2 bytes, how far back the match starts.
+//
+// The last sequence only has literals.
+
+static constexpr u32 MIN_MATCH = 4;
+static constexpr u32 MAX_OFFSET = 0xFFFF;
+static constexpr u32 HASH_BITS = 14;
+
+static u32 read_u32(const u8 *ptr) {
+    u32 value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static u32 hash_sequence(u32 sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static u8 *write_length(u8 *out, u32 length) {
+    for (; length >= 255; length -= 255)
+        *(out++) = 255;
+    *(out++) = length;
+    return out;
+}
+
+static u8 *write_sequence(u8 *out, const u8 *literals, u32 num_literals,
+                          u32 offset, u32 match_length) {
+    u8 *token = out++;
+    u32 literal_code = MIN(num_literals, 15u);
+    if (literal_code == 15)
+        out = write_length(out, num_literals - 15);
+    memcpy(out, literals, num_literals);
+    out += num_literals;
+    if (!match_length) {
+        *token = literal_code << 4;
+        return out;
+    }
+    *(out++) = offset & 0xFF;
+    *(out++) = offset >> 8;
+    u32 match_code = MIN(match_length - MIN_MATCH, 15u);
+    if (match_code == 15)
+        out = write_length(out, match_length - MIN_MATCH - 15);
+    *token = (literal_code << 4) | match_code;
+    return out;
+}
+
+u32 compress_bound(u32 size) {
+    return size + size / 255 + 16;
+}
+
+u32 compress(const u8 *in, u32 size, u8 *out) {
+    u32 table[1 << HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    u8 *out_start = out;
+    u32 anchor = 0;
+    u32 cursor = 0;
+    while (size >= MIN_MATCH && cursor <= size - MIN_MATCH) {
+        u32 sequence = read_u32(in + cursor);
+        u32 hash = hash_sequence(sequence);
+        u32 candidate = table[hash];
+        table[hash] = cursor;
+        if (candidate == 0xFFFFFFFF || cursor - candidate > MAX_OFFSET ||
+            read_u32(in + candidate) != sequence) {
+            cursor++;
+            continue;
+        }
+
+        u32 length = MIN_MATCH;
+        while (cursor + length < size && in[candidate + length] == in[cursor + length])
+            length++;
+        out = write_sequence(out, in + anchor, cursor - anchor,
+                             cursor - candidate, length);
+        cursor += length;
+        anchor = cursor;
+    }
+    out = write_sequence(out, in + anchor, size - anchor, 0, 0);
+    return out - out_start;
+}
+
+static bool read_length(const u8 **in, const u8 *end, u32 *length) {
+    u8 byte;
+    do {
+        if (*in == end) return false;
+        byte = *((*in)++);
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool decompress(const u8 *in, u32 size, u8 *out, u32 raw_size) {
+    const u8 *end = in + size;
+    u8 *out_start = out;
+    u8 *out_end = out + raw_size;
+    while (in < end) {
+        u8 token = *(in++);
+        u32 num_literals = token >> 4;
+        if (num_literals == 15 && !read_length(&in, end, &num_literals))
+            return false;
+        if ((u64) (end - in) < num_literals || (u64) (out_end - out) < num_literals)
+            return false;
+        if ((u64) (end - in) >= num_literals + 16 &&
+            (u64) (out_end - out) >= num_literals + 16) {
+            // There's room to copy past the end, which lets the
+            // copy be done in larger pieces.
+            for (u32 i = 0; i < num_literals; i += 16)
+                memcpy(out + i, in + i, 16);
+        } else {
+            memcpy(out, in, num_literals);
+        }
+        in += num_literals;
+        out += num_literals;
+        if (in == end) break;
+
+        if (end - in < 2) return false;
+        u32 offset = in[0] | (in[1] << 8);
+        in += 2;
+        u32 length = token & 0xF;
+        if (length == 15 && !read_length(&in, end, &length))
+            return false;
+        length += MIN_MATCH;
+        if (!offset || (u64) (out - out_start) < offset ||
+            (u64) (out_end - out) < length)
+            return false;
+
+        const u8 *match = out - offset;
+        if (offset >= 8 && (u64) (out_end - out) >= length + 8) {
+            for (u32 i = 0; i < length; i += 8)
+                memcpy(out + i, match + i, 8);
+            out += length;
+        } else if (offset >= length) {
+            memcpy(out, match, length);
+            out += length;
+        } else {
+            // The match overlaps what's being written, so it
+            // repeats, which has to be copied a byte at a time.
+            for (u32 i = 0; i < length; i++)
+                *(out++) = match[i];
+        }
+    }
+    return out == out_end;
+}
+
+u64 compress_blocks_bound(u32 size) {
+    u32 num_blocks = (size + BlockHeader::BLOCK_SIZE - 1) / BlockHeader::BLOCK_SIZE;
+    return sizeof(BlockHeader) + (num_blocks + 1) * sizeof(u32) +
+           num_blocks * (u64) compress_bound(BlockHeader::BLOCK_SIZE);
+}
+
+u64 compress_blocks(const u8 *in, u32 size, u8 *out) {
+    BlockHeader *header = (BlockHeader *) out;
+    header->raw_size = size;
+    header->num_blocks = (size + BlockHeader::BLOCK_SIZE - 1) / BlockHeader::BLOCK_SIZE;
+    u32 *offsets = header->offsets();
+    u8 *blocks = (u8 *) (offsets + header->num_blocks + 1);
+
+    u32 offset = 0;
+    for (u32 i = 0; i < header->num_blocks; i++) {
+        offsets[i] = offset;
+        offset += compress(in + i * BlockHeader::BLOCK_SIZE,
+                           header->raw_block_size(i), blocks + offset);
+    }
+    offsets[header->num_blocks] = offset;
+    return (blocks + offset) - out;
+}
+
+bool decompress_block(BlockHeader *header, u32 index, u8 *out) {
+    ASSERT(index < header->num_blocks, "Invalid block");
+    return decompress(header->block(index), header->block_size(index),
+                      out + index * BlockHeader::BLOCK_SIZE,
+                      header->raw_block_size(index));
+}
+
+}
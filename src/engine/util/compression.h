@@ -0,0 +1,68 @@
+namespace Util {
+
+///# Compression
+// A small LZ77 codec in the style of LZ4, it's used for the assets.
+// It doesn't compress as well as zlib, but decompressing is a couple of
+// memcpys per match, which is a lot faster than reading from the disk.
+// Larger buffers are split into blocks that are compressed on their
+// own, so they can be decompressed in parallel.
+
+// The start of a buffer made by "compress_blocks". It's followed by
+// the offset of each block, and one more offset for the end, which are
+// relative to the end of the offsets.
+struct BlockHeader {
+    static constexpr u32 BLOCK_SIZE = 1 << 16;
+
+    u32 raw_size;
+    u32 num_blocks;
+
+    u32 *offsets() {
+        return (u32 *) (this + 1);
+    }
+
+    const u8 *block(u32 index) {
+        return (u8 *) (offsets() + num_blocks + 1) + offsets()[index];
+    }
+
+    u32 block_size(u32 index) {
+        return offsets()[index + 1] - offsets()[index];
+    }
+
+    u32 raw_block_size(u32 index) {
+        return MIN(BLOCK_SIZE, raw_size - index * BLOCK_SIZE);
+    }
+};
+
+///*
+// The largest number of bytes "compress" can write for
+// "size" bytes of input.
+u32 compress_bound(u32 size);
+
+///*
+// Compresses "size" bytes from "in" into "out", returns the
+// size of the compressed data. "out" has to fit
+// "compress_bound(size)" bytes.
+u32 compress(const u8 *in, u32 size, u8 *out);
+
+///*
+// Decompresses "size" bytes from "in" into "out", returns false
+// if the data is broken or doesn't decompress to exactly
+// "raw_size" bytes.
+bool decompress(const u8 *in, u32 size, u8 *out, u32 raw_size);
+
+///*
+// The largest number of bytes "compress_blocks" can write
+// for "size" bytes of input.
+u64 compress_blocks_bound(u32 size);
+
+///*
+// Splits the data into blocks and compresses them, "out" starts
+// with a BlockHeader. Returns the number of bytes written.
+u64 compress_blocks(const u8 *in, u32 size, u8 *out);
+
+///*
+// Decompresses one block of data made by "compress_blocks",
+// the blocks can be decompressed on different threads.
+bool decompress_block(BlockHeader *header, u32 index, u8 *out);
+
+}
@@ -0,0 +1,144 @@
+namespace Util {
+
+static thread_local u32 _fog_worker_id = 0;
+static thread_local bool _fog_main_thread = false;
+
+// Takes the next job from the queue, returns false if the
+// queue is empty. Assumes the lock is held.
+static bool pop_job(Job *job) {
+    if (_fog_jobs.head == _fog_jobs.tail) return false;
+    *job = std::move(_fog_jobs.queue[_fog_jobs.head]);
+    _fog_jobs.queue[_fog_jobs.head] = nullptr;
+    _fog_jobs.head = (_fog_jobs.head + 1) % JobSystem::QUEUE_SIZE;
+    return true;
+}
+
+static void worker_loop(u32 id) {
+    _fog_worker_id = id;
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(_fog_jobs.lock);
+            _fog_jobs.wake.wait(guard, []() {
+                return !_fog_jobs.running || _fog_jobs.head != _fog_jobs.tail;
+            });
+            // Whatever is left in the queue is finished before stopping.
+            if (!pop_job(&job)) return;
+        }
+        job();
+    }
+}
+
+bool init_jobs(u32 num_workers) {
+    if (!num_workers) {
+        u32 cores = std::thread::hardware_concurrency();
+        num_workers = cores ? cores - 1 : 0;
+    }
+    num_workers = MIN(num_workers, JobSystem::MAX_WORKERS);
+    _fog_main_thread = true;
+
+    _fog_jobs.head = 0;
+    _fog_jobs.tail = 0;
+    _fog_jobs.running = true;
+    _fog_jobs.num_workers = num_workers;
+    for (u32 i = 0; i < num_workers; i++)
+        _fog_jobs.workers[i] = std::thread(worker_loop, i + 1);
+    // The threads have to be stopped before they're destroyed.
+    atexit(stop_jobs);
+    return true;
+}
+
+void stop_jobs() {
+    if (_fog_worker_id) {
+        // A worker can't wait for itself, this only happens
+        // when the program is going down anyway.
+        for (u32 i = 0; i < _fog_jobs.num_workers; i++)
+            _fog_jobs.workers[i].detach();
+        _fog_jobs.num_workers = 0;
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(_fog_jobs.lock);
+        _fog_jobs.running = false;
+    }
+    _fog_jobs.wake.notify_all();
+    for (u32 i = 0; i < _fog_jobs.num_workers; i++)
+        _fog_jobs.workers[i].join();
+    _fog_jobs.num_workers = 0;
+}
+
+u32 num_workers() {
+    return _fog_jobs.num_workers;
+}
+
+u32 worker_id() {
+    return _fog_worker_id;
+}
+
+bool on_main_thread() {
+    return _fog_main_thread;
+}
+
+void schedule_job(Job job) {
+    if (_fog_jobs.num_workers) {
+        std::lock_guard<std::mutex> guard(_fog_jobs.lock);
+        u32 next = (_fog_jobs.tail + 1) % JobSystem::QUEUE_SIZE;
+        if (next != _fog_jobs.head) {
+            _fog_jobs.queue[_fog_jobs.tail] = std::move(job);
+            _fog_jobs.tail = next;
+            _fog_jobs.wake.notify_one();
+            return;
+        }
+    }
+    job();
+}
+
+// The state of one "parallel_for", it's shared so a worker
+// that picks up its job late doesn't touch freed memory.
+struct ParallelFor {
+    std::atomic<u32> next;
+    std::atomic<u32> done;
+    u32 num_chunks;
+    u32 count;
+    u32 chunk_size;
+    RangeFunc f;
+};
+
+static void run_chunks(ParallelFor *work) {
+    u32 chunk;
+    while ((chunk = work->next++) < work->num_chunks) {
+        u32 begin = chunk * work->chunk_size;
+        u32 end = MIN(begin + work->chunk_size, work->count);
+        work->f(begin, end);
+        work->done++;
+    }
+}
+
+void parallel_for(u32 count, u32 chunk_size, RangeFunc f) {
+    if (!count) return;
+    ASSERT(chunk_size, "Chunk size has to be larger than zero");
+    u32 num_chunks = (count + chunk_size - 1) / chunk_size;
+    if (!_fog_jobs.num_workers || num_chunks == 1) {
+        for (u32 begin = 0; begin < count; begin += chunk_size)
+            f(begin, MIN(begin + chunk_size, count));
+        return;
+    }
+
+    auto work = std::make_shared<ParallelFor>();
+    work->next = 0;
+    work->done = 0;
+    work->num_chunks = num_chunks;
+    work->count = count;
+    work->chunk_size = chunk_size;
+    work->f = f;
+
+    u32 helpers = MIN(_fog_jobs.num_workers, num_chunks - 1);
+    for (u32 i = 0; i < helpers; i++)
+        schedule_job([work]() { run_chunks(work.get()); });
+
+    run_chunks(work.get());
+    while (work->done.load() < num_chunks)
+        std::this_thread::yield();
+}
+
+}
@@ -0,0 +1,76 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace Util {
+
+///# Jobs
+// A small pool of worker threads that the engine uses to spread
+// work out over the cores. The main thread always helps out with
+// the work it hands out, so nothing stalls if the workers are busy.
+
+typedef Function<void()> Job;
+
+///* RangeFunc
+// The function type for "parallel_for", called with a range of
+// indicies [begin, end).
+typedef Function<void(u32 begin, u32 end)> RangeFunc;
+
+struct JobSystem {
+    static constexpr u32 MAX_WORKERS = 16;
+
+    std::thread workers[MAX_WORKERS];
+    u32 num_workers;
+    bool running;
+
+    // A fixed ring of jobs, if it's full the job is run
+    // by the thread that scheduled it.
+    static constexpr u32 QUEUE_SIZE = 256;
+    Job queue[QUEUE_SIZE];
+    u32 head;
+    u32 tail;
+
+    std::mutex lock;
+    std::condition_variable wake;
+} _fog_jobs;
+
+// Starts the worker threads, if "num_workers" is zero the
+// number of cores, minus the main thread, is used. Has to be
+// called from the main thread.
+bool init_jobs(u32 num_workers=0);
+
+// Stops all worker threads, waits for them to finish the
+// jobs they are working on.
+void stop_jobs();
+
+///*
+// Returns the number of worker threads, not counting
+// the main thread.
+u32 num_workers();
+
+///*
+// Returns the index of the thread calling this, the main
+// thread is 0 and the workers are numbered from 1.
+u32 worker_id();
+
+///*
+// Returns true on the thread that called "init_jobs", which is the
+// main thread. Threads that aren't workers, like the asset loader,
+// also have 0 as their worker id, so this is what to check for
+// things that are only safe on the main thread.
+bool on_main_thread();
+
+///*
+// Calls "f" on chunks of the range [0, count), where each
+// chunk is at most "chunk_size" long. The chunks are processed
+// in parallel and the call returns when all of them are done.
+void parallel_for(u32 count, u32 chunk_size, RangeFunc f);
+
+///*
+// Runs the job on one of the workers at some point in the
+// future, if there are no workers it is run straight away.
+void schedule_job(Job job);
+
+}
@@ -13,7 +13,11 @@ enum class MemoryAllocationState {
     ILLEGAL,
     NO_RULE,
 };
-static MemoryAllocationState _fog_mem_alloc_state = MemoryAllocationState::NO_RULE;
+// Every thread has its own rule, the workers and the asset loader
+// never get a strict one, since they're allowed to allocate.
+static thread_local MemoryAllocationState _fog_mem_alloc_state = MemoryAllocationState::NO_RULE;
+// The free arenas are shared by all threads.
+static std::mutex arena_lock;
 
 #define CHECK_ILLEGAL_ALLOC \
     do {\
@@ -63,6 +67,7 @@ void do_all_allocations() {
         global_memory.all_regions[i].memory = malloc(ARENA_SIZE_IN_BYTES);
     }
     global_memory.all_regions[NUM_ARENAS - 1].next = 0;
+    global_memory.all_regions[NUM_ARENAS - 1].memory = malloc(ARENA_SIZE_IN_BYTES);
 
     // Frame memory
     for (u32 i = 0; i < FRAME_LAG_FOR_MEMORY; i++)
@@ -76,20 +81,27 @@ void swap_frame_memory() {
     FRAME_MEMORY[CURRENT_MEMORY]->clear();
 }
 
+// The frame memory isn't locked, so only the main thread can use it.
+#define CHECK_FRAME_MEMORY_THREAD \
+    ASSERT(on_main_thread(), "Frame memory can only be used on the main thread")
+
 template <typename T>
 T *request_temporary_memory(u64 num) {
+    CHECK_FRAME_MEMORY_THREAD;
     allow_allocation();
     return FRAME_MEMORY[CURRENT_MEMORY]->push<T>(num);
 }
 
 template <typename T>
 T *temporary_push(T t) {
+    CHECK_FRAME_MEMORY_THREAD;
     allow_allocation();
     return FRAME_MEMORY[CURRENT_MEMORY]->push(t);
 }
 
 MemoryArena *request_arena(bool only_one) {
     CHECK_ILLEGAL_ALLOC;
+    std::lock_guard<std::mutex> guard(arena_lock);
     ASSERT(global_memory.free_regions, "No more memory");
     ASSERT(global_memory.num_free_regions, "No more memory");
     MemoryArena *next = global_memory.free_regions;
@@ -103,10 +115,14 @@ MemoryArena *request_arena(bool only_one) {
 
 void return_arean(MemoryArena *arena) {
     ASSERT(arena, "nullptr is not a valid argument.");
-    if (arena->next) return_arean(arena->next);
-    ++global_memory.num_free_regions;
-    arena->next = global_memory.free_regions;
-    global_memory.free_regions = arena;
+    std::lock_guard<std::mutex> guard(arena_lock);
+    while (arena) {
+        MemoryArena *next = arena->next;
+        ++global_memory.num_free_regions;
+        arena->next = global_memory.free_regions;
+        global_memory.free_regions = arena;
+        arena = next;
+    }
 }
 
 template <typename T>
@@ -121,6 +137,8 @@ T *MemoryArena::push(u64 count) {
             allow_allocation();
             next = request_arena();
         }
+        // This is already checked.
+        allow_allocation();
         return next->push<T>(count);
     }
     void *region = (void *) (((u8 *) memory) + watermark);
@@ -136,11 +154,9 @@ T *MemoryArena::push(T type) {
 }
 
 void MemoryArena::clear() {
-    while (next) {
-        MemoryArena *old = next;
-        next = next->next;
-        return_arean(old);
-    }
+    // Returns the whole chain.
+    if (next) return_arean(next);
+    next = 0;
     watermark = 0;
 }
 
@@ -153,14 +169,16 @@ void MemoryArena::pop() { return_arean(this); }
 // replaced some time later.
 
 template <typename T>
-T *push_memory(u32 num) {
+T *push_memory(u64 num) {
     CHECK_ILLEGAL_ALLOC;
+    ASSERT(num <= ((u64) -1) / sizeof(T), "The allocation is too large");
     return (T *) malloc(sizeof(T) * num);
 }
 
 template <typename T>
-T *resize_memory(T *data, u32 num) {
+T *resize_memory(T *data, u64 num) {
     CHECK_ILLEGAL_ALLOC;
+    ASSERT(num <= ((u64) -1) / sizeof(T), "The allocation is too large");
     return (T *) realloc(data, sizeof(T) * num);
 }
 
@@ -170,10 +188,7 @@ void pop_memory(T *data) {
 }
 
 void copy_bytes(void *from, void *to, u64 size) {
-    // TODO(ed): memcpy might be like... A lot faster..
-    u8 *_to = (u8 *) to;
-    u8 *_from = (u8 *) from;
-    while(size--) *(_to++) = *(_from++);
+    memcpy(to, from, size);
 }
 
 }  // namespace Util
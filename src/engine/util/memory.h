@@ -69,7 +69,7 @@ T *temporary_push(T t);
 // Note that "num" is the number of elemnts to
 // allocate.
 template <typename T>
-T *push_memory(u32 num = 1);
+T *push_memory(u64 num = 1);
 
 ///*
 // Like realloc, but a little bit more C++.
@@ -77,7 +77,7 @@ T *push_memory(u32 num = 1);
 // Note that "num" is the number of elemnts to
 // allocate.
 template <typename T>
-T *resize_memory(T *data, u32 num);
+T *resize_memory(T *data, u64 num);
 
 ///*
 // Like free but, not.
@@ -91,6 +91,10 @@ void report() {
     snprintf(buffer, buffer_size, "  %-17s: %5ld",
              "FREE ARENAS", Util::global_memory.num_free_regions);
     Util::debug_text(buffer, y -= dy);
+    snprintf(buffer, buffer_size, "  %-17s: %5u %9lu",
+             "DEFRAG MOVED", Logic::_fog_es.defrag_moved_entities,
+             Logic::_fog_es.defrag_moved_bytes);
+    Util::debug_text(buffer, y -= dy);
 }
 
 }  // namespace Perf
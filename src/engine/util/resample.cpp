@@ -0,0 +1,236 @@
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace Util {
+
+// How much of the band under the Nyquist frequency the filters let
+// through, the rest is where they fade out.
+static constexpr f64 RESAMPLE_PASSBAND = 0.86;
+// Higher values of beta give a better stopband but a slower fade.
+static constexpr f64 KAISER_BETA = 7.0;
+
+static constexpr u32 PHASE_BITS = 8;
+static constexpr u32 PHASE_SHIFT = RESAMPLE_FRACTION_BITS - PHASE_BITS;
+static constexpr u32 PHASE_MASK = (1 << PHASE_SHIFT) - 1;
+static_assert(RESAMPLE_PHASES == 1 << PHASE_BITS, "The phases are the top bits of the fraction");
+static_assert(RESAMPLE_TAPS % 4 == 0, "The taps are summed four at a time");
+
+// The zeroth order modified Bessel function, as a series.
+static f64 bessel_i0(f64 x) {
+    f64 sum = 1.0;
+    f64 term = 1.0;
+    for (u32 k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// A sinc with "cutoff" windowed to "half_width" frames on each side,
+// "x" is the distance in frames.
+static f64 windowed_sinc(f64 x, f64 cutoff, f64 half_width) {
+    if (x <= -half_width || half_width <= x) return 0.0;
+    f64 r = x / half_width;
+    f64 window = bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) / bessel_i0(KAISER_BETA);
+    f64 s = cutoff * x;
+    f64 sinc = s == 0.0 ? 1.0 : sin(M_PI * s) / (M_PI * s);
+    return cutoff * sinc * window;
+}
+
+// Fills in the filters that let frequencies below "cutoff" through,
+// where 1 is half the sample rate of the input.
+static void init_resample_table(ResampleTable *table, f64 cutoff) {
+    for (u32 phase = 0; phase <= RESAMPLE_PHASES; phase++) {
+        f64 fraction = (f64) phase / RESAMPLE_PHASES;
+        f64 weights[RESAMPLE_TAPS];
+        f64 sum = 0.0;
+        for (u32 k = 0; k < RESAMPLE_TAPS; k++) {
+            f64 x = (f64) k - (RESAMPLE_HALF_TAPS - 1) - fraction;
+            weights[k] = windowed_sinc(x, cutoff, RESAMPLE_HALF_TAPS);
+            sum += weights[k];
+        }
+        // Normalized so a constant signal stays the same.
+        for (u32 k = 0; k < RESAMPLE_TAPS; k++)
+            table->taps[phase][k] = weights[k] / sum;
+    }
+}
+
+void init_resample_tables(ResampleTable *tables) {
+    for (u32 i = 0; i < NUM_RESAMPLE_TABLES; i++)
+        init_resample_table(tables + i, RESAMPLE_PASSBAND / MAX(1.0f, RESAMPLE_TABLE_STEPS[i]));
+}
+
+u32 resample_table_for(u64 step) {
+    f32 frames = (f32) step / RESAMPLE_ONE;
+    for (u32 i = 0; i < NUM_RESAMPLE_TABLES - 1; i++)
+        if (frames <= RESAMPLE_TABLE_STEPS[i]) return i;
+    return NUM_RESAMPLE_TABLES - 1;
+}
+
+#ifdef __SSE__
+static f32 horizontal_sum(__m128 v) {
+    __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+#endif
+
+template <bool STEREO>
+static u64 resample_sinc(const ResampleTable *table,
+                         const f32 *in_left, const f32 *in_right,
+                         u64 position, u64 step,
+                         f32 *out_left, f32 *out_right, u32 count) {
+    for (u32 i = 0; i < count; i++, position += step) {
+        u64 offset = position >> RESAMPLE_FRACTION_BITS;
+        u32 fraction = (u32) position;
+        const f32 *a = table->taps[fraction >> PHASE_SHIFT];
+        const f32 *b = table->taps[(fraction >> PHASE_SHIFT) + 1];
+        f32 t = (fraction & PHASE_MASK) * (1.0f / (PHASE_MASK + 1));
+        const f32 *left = in_left + offset;
+        const f32 *right = STEREO ? in_right + offset : nullptr;
+#ifdef __SSE__
+        // The filter is interpolated between the two closest
+        // phases, and used for both channels.
+        __m128 between = _mm_set1_ps(t);
+        __m128 sum_left = _mm_setzero_ps();
+        __m128 sum_right = _mm_setzero_ps();
+        for (u32 k = 0; k < RESAMPLE_TAPS; k += 4) {
+            __m128 from = _mm_load_ps(a + k);
+            __m128 to = _mm_load_ps(b + k);
+            __m128 weight = _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), between));
+            sum_left = _mm_add_ps(sum_left, _mm_mul_ps(weight, _mm_loadu_ps(left + k)));
+            if (STEREO)
+                sum_right = _mm_add_ps(sum_right, _mm_mul_ps(weight, _mm_loadu_ps(right + k)));
+        }
+        out_left[i] = horizontal_sum(sum_left);
+        if (STEREO)
+            out_right[i] = horizontal_sum(sum_right);
+#else
+        f32 sum_left = 0.0;
+        f32 sum_right = 0.0;
+        for (u32 k = 0; k < RESAMPLE_TAPS; k++) {
+            f32 weight = a[k] + (b[k] - a[k]) * t;
+            sum_left += weight * left[k];
+            if (STEREO)
+                sum_right += weight * right[k];
+        }
+        out_left[i] = sum_left;
+        if (STEREO)
+            out_right[i] = sum_right;
+#endif
+    }
+    return position;
+}
+
+template <bool STEREO>
+static u64 resample_linear(const f32 *in_left, const f32 *in_right,
+                           u64 position, u64 step,
+                           f32 *out_left, f32 *out_right, u32 count) {
+    for (u32 i = 0; i < count; i++, position += step) {
+        u64 offset = (position >> RESAMPLE_FRACTION_BITS) + RESAMPLE_HALF_TAPS - 1;
+        f32 t = (u32) position * (1.0f / RESAMPLE_ONE);
+        out_left[i] = in_left[offset] + (in_left[offset + 1] - in_left[offset]) * t;
+        if (STEREO)
+            out_right[i] = in_right[offset] + (in_right[offset + 1] - in_right[offset]) * t;
+    }
+    return position;
+}
+
+template <bool STEREO>
+static u64 resample_nearest(const f32 *in_left, const f32 *in_right,
+                            u64 position, u64 step,
+                            f32 *out_left, f32 *out_right, u32 count) {
+    for (u32 i = 0; i < count; i++, position += step) {
+        u64 offset = (position >> RESAMPLE_FRACTION_BITS) + RESAMPLE_HALF_TAPS - 1;
+        out_left[i] = in_left[offset];
+        if (STEREO)
+            out_right[i] = in_right[offset];
+    }
+    return position;
+}
+
+u64 resample(Resampling mode, const ResampleTable *table,
+             const f32 *in_left, const f32 *in_right,
+             u64 position, u64 step,
+             f32 *out_left, f32 *out_right, u32 count) {
+    bool stereo = in_right != nullptr;
+    switch (mode) {
+        case Resampling::NEAREST:
+            if (stereo)
+                return resample_nearest<true>(in_left, in_right, position, step, out_left, out_right, count);
+            return resample_nearest<false>(in_left, in_right, position, step, out_left, out_right, count);
+        case Resampling::LINEAR:
+            if (stereo)
+                return resample_linear<true>(in_left, in_right, position, step, out_left, out_right, count);
+            return resample_linear<false>(in_left, in_right, position, step, out_left, out_right, count);
+        case Resampling::SINC:
+            if (stereo)
+                return resample_sinc<true>(table, in_left, in_right, position, step, out_left, out_right, count);
+            return resample_sinc<false>(table, in_left, in_right, position, step, out_left, out_right, count);
+    }
+    UNREACHABLE;
+    return position;
+}
+
+// Offline there's time for a longer filter.
+static constexpr s64 OFFLINE_HALF_TAPS = 64;
+
+u64 resampled_length(u64 num_frames, u32 from_rate, u32 to_rate) {
+    return (num_frames * to_rate + from_rate - 1) / from_rate;
+}
+
+static u64 greatest_common_divisor(u64 a, u64 b) {
+    while (b) {
+        u64 r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+u64 resample_offline(const f32 *in, u64 num_frames, u32 channels,
+                     u32 from_rate, u32 to_rate, f32 *out) {
+    ASSERT(from_rate && to_rate, "Invalid sample rate");
+    ASSERT(channels == 1 || channels == 2, "Only mono and stereo can be resampled");
+    f64 cutoff = RESAMPLE_PASSBAND * MIN(1.0, (f64) to_rate / from_rate);
+    // The filter is stretched out with the cutoff, so it
+    // has as many zero crossings when downsampling.
+    f64 half_width = OFFLINE_HALF_TAPS * RESAMPLE_PASSBAND / cutoff;
+    s64 width = (s64) ceil(half_width);
+
+    // The fraction of the position repeats with a period of
+    // "to_rate / gcd", so only that many filters are needed.
+    u64 divisor = greatest_common_divisor(from_rate, to_rate);
+    u64 num_phases = to_rate / divisor;
+    f64 *filters = new f64[num_phases * 2 * width];
+    for (u64 phase = 0; phase < num_phases; phase++) {
+        f64 fraction = (f64) phase / num_phases;
+        for (s64 k = 0; k < 2 * width; k++)
+            filters[phase * 2 * width + k] =
+                windowed_sinc(k - (width - 1) - fraction, cutoff, half_width);
+    }
+
+    u64 num_out = resampled_length(num_frames, from_rate, to_rate);
+    for (u64 frame = 0; frame < num_out; frame++) {
+        s64 center = frame * from_rate / to_rate;
+        u64 phase = (frame * from_rate % to_rate) / divisor;
+        const f64 *filter = filters + phase * 2 * width;
+        s64 first = MAX(center - width + 1, (s64) 0);
+        s64 last = MIN(center + width, (s64) num_frames - 1);
+        f64 sum[2] = {};
+        f64 total = 0.0;
+        for (s64 i = first; i <= last; i++) {
+            f64 weight = filter[i - (center - width + 1)];
+            for (u32 c = 0; c < channels; c++)
+                sum[c] += weight * in[i * channels + c];
+            total += weight;
+        }
+        // Normalized, which also keeps the edges from fading out.
+        for (u32 c = 0; c < channels; c++)
+            out[frame * channels + c] = total != 0.0 ? sum[c] / total : 0.0;
+    }
+    delete[] filters;
+    return num_out;
+}
+
+}
@@ -0,0 +1,76 @@
+namespace Util {
+
+///# Resampling
+// Changes the sample rate of sounds. The mixer resamples every
+// source on the fly, since the pitch can be anything, with a
+// windowed sinc filter looked up in precomputed tables. Mist can
+// convert sounds ahead of time with a longer filter, which is slow
+// but only done once.
+//
+// Positions are fixed point, with RESAMPLE_FRACTION_BITS bits after
+// the point, so long sounds don't lose precision.
+
+constexpr u32 RESAMPLE_FRACTION_BITS = 32;
+constexpr u64 RESAMPLE_ONE = (u64) 1 << RESAMPLE_FRACTION_BITS;
+
+// The number of input frames each output frame is made from,
+// half of them are before the position.
+constexpr u32 RESAMPLE_TAPS = 32;
+constexpr u32 RESAMPLE_HALF_TAPS = RESAMPLE_TAPS / 2;
+// The number of fractional positions the table has filters for,
+// the filters in between are interpolated.
+constexpr u32 RESAMPLE_PHASES = 256;
+
+///* Resampling
+// How the sources are resampled. NEAREST is the cheapest and
+// aliases the most, SINC is the most expensive and the cleanest.
+enum class Resampling {
+    NEAREST,
+    LINEAR,
+    SINC,
+};
+
+// The filters for one cutoff frequency, a filter for each phase
+// and one extra so there's always a next phase to interpolate to.
+struct ResampleTable {
+    alignas(16) f32 taps[RESAMPLE_PHASES + 1][RESAMPLE_TAPS];
+};
+
+// Tables for steps up to these limits, a larger step has to filter
+// out more of the sound to not alias. Steps larger than the last
+// limit use the last table.
+constexpr f32 RESAMPLE_TABLE_STEPS[] = {1.02, 1.25, 1.5, 2.0, 3.0, 4.0};
+constexpr u32 NUM_RESAMPLE_TABLES = LEN(RESAMPLE_TABLE_STEPS);
+
+// Fills in the NUM_RESAMPLE_TABLES tables, one for each step limit.
+void init_resample_tables(ResampleTable *tables);
+
+// Returns which of the tables should be used for "step".
+u32 resample_table_for(u64 step);
+
+///*
+// Writes "count" frames to "out", starting at "position" and moving
+// "step" frames in "in" for each frame. The output frame at
+// "position" is made from RESAMPLE_TAPS frames, starting at the
+// whole part of "position", so the position falls between the two
+// middle taps. If "in_right" is nullptr only one channel is
+// resampled. Returns the position after the last frame.
+u64 resample(Resampling mode, const ResampleTable *table,
+             const f32 *in_left, const f32 *in_right,
+             u64 position, u64 step,
+             f32 *out_left, f32 *out_right, u32 count);
+
+///*
+// Converts interleaved frames with "channels" channels from
+// "from_rate" to "to_rate", "out" has to fit
+// "resampled_length(num_frames, from_rate, to_rate)" frames.
+// Returns the number of frames written.
+u64 resample_offline(const f32 *in, u64 num_frames, u32 channels,
+                     u32 from_rate, u32 to_rate, f32 *out);
+
+///*
+// The number of frames "num_frames" frames become when
+// converted from "from_rate" to "to_rate".
+u64 resampled_length(u64 num_frames, u32 from_rate, u32 to_rate);
+
+}
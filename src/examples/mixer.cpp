@@ -24,6 +24,7 @@ Mixer::fetch_channel(0)->set_delay(0.3, 0.2);
 // 0.2 seconds, which means that every sound played is played again 0.2 seconds
 // later with only 30% of the original volume.</p>
 // <p>The delay can then be de-activated at a later point in time.</p>
-Mixer::fetch_channel(0)->delay.active = false;
-// The effect-parameters can also be changed at any time.
-Mixer::fetch_channel(0)->delay.feedback = 0.5;
+Mixer::fetch_channel(0)->set_delay(0.0, 0.0);
+// The effect-parameters can also be changed at any time, they fade to the
+// new values over the last argument, in seconds.
+Mixer::fetch_channel(0)->set_delay(0.5, 0.2, 0.5);
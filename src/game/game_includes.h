@@ -62,6 +62,8 @@ namespace Perf {
         INPUT,
         RENDER,
         TEXT,
+        ASSET_UPLOAD,
+        LEVEL_STREAM,
 
         ENTITY_UPDATE,
         ENTITY_DRAW,
@@ -82,6 +84,7 @@ namespace Logic {
         BASE,
         ROBOT,
         BULLET,
+        BENCHMARK, // Used by the entity benchmark.
 
         NUM_ENTITY_TYPES, // Don't write anything after this.
     };
@@ -24,6 +24,10 @@ Physics::Body grounds[2];
 u32 PLAYER_LAYER = 3;
 
 struct Bullet : public Logic::Entity {
+    // Only the bullet's own body is touched in the update, the
+    // collisions and the effects are handled on the main thread.
+    static constexpr bool parallel_update = true;
+
     Physics::Body body;
     f32 offset = 0.25;
     f32 size = 0.10;
@@ -35,6 +39,7 @@ struct Bullet : public Logic::Entity {
     void destroy();
 
     void update(f32 delta);
+    void collide();
 
     void draw();
 
@@ -64,6 +69,14 @@ void Bullet::destroy() {
 void Bullet::update(f32 delta) {
     Physics::integrate(&body, delta);
     life -= delta;
+    Logic::EntityID self = id;
+    Logic::defer_call([self]() {
+        if (Logic::valid_entity(self))
+            Logic::fetch_entity<Bullet>(self)->collide();
+    });
+}
+
+void Bullet::collide() {
     bullet_particles.position = body.position;
     bullet_particles.spawn();
     if (life < 0) {